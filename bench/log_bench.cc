@@ -0,0 +1,299 @@
+/**
+ * @brief 日志调用的整体耗时基准
+ * @details 按宏形式(流式/FMT), 级别开关, LogFormatter模板, Appender和生产线程数组合,
+ *          测量每次日志调用的耗时和每秒写入行数, 结果以JSON输出作为回归基线.
+ *          用法: sylar_log_bench [-n calls_per_thread] [-t max_threads] [-f filter]
+ *                                [-d dir] [-o output.json]
+ */
+#include "sylar/log.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @brief 只格式化不输出的Appender, 用来单独测量日志路径和格式化
+ */
+class NullLogAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override {
+        static thread_local sylar::LogBuffer t_buf;
+        t_buf.clear();
+        m_formatter->format(t_buf, *logger, level, *event);
+    }
+};
+
+const char* s_peer = "10.0.0.1:8080";
+
+void StreamInfo(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_INFO(logger) << "request " << i << " from " << s_peer << " took " << 1.25 << "ms";
+}
+
+void FmtInfo(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_FMT_INFO(logger, "request %d from %s took %.2fms", i, s_peer, 1.25);
+}
+
+void BraceInfo(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_BRACE_INFO(logger, "request {} from {} took {}ms", i, s_peer, 1.25);
+}
+
+void StreamDebug(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_DEBUG(logger) << "request " << i << " from " << s_peer << " took " << 1.25 << "ms";
+}
+
+void FmtDebug(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_FMT_DEBUG(logger, "request %d from %s took %.2fms", i, s_peer, 1.25);
+}
+
+void StreamKvInfo(const sylar::Logger::ptr& logger, int i) {
+    SYLAR_LOG_INFO(logger).kv("request", i).kv("peer", s_peer).kv("ms", 1.25) << "request done";
+}
+
+const char* s_fullPattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+const char* s_defaultPattern = "%d  [%p] %f %l %m %n";
+const char* s_messagePattern = "%m%n";
+const char* s_kvPattern = "%d [%p] %m%K%n";
+/// 使用JsonLogFormatter
+const char* s_jsonPattern = "json";
+
+/**
+ * @brief 一个测试场景
+ */
+struct Case {
+    /// 名称
+    std::string name;
+    /// 调用方式
+    void (*call)(const sylar::Logger::ptr&, int);
+    /// Appender名称
+    std::string appender;
+    /// LogFormatter模板
+    const char* pattern;
+    /// 日志器级别
+    sylar::LogLevel::Level level;
+};
+
+struct Options {
+    int calls = 200000;
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string filter;
+    std::string dir = "/tmp";
+    std::string output;
+};
+
+Options s_options;
+
+sylar::LogAppender::ptr CreateAppender(const std::string& name, const std::string& file) {
+    if (name == "null") {
+        return sylar::LogAppender::ptr(new NullLogAppender);
+    } else if (name == "stdout") {
+        return sylar::LogAppender::ptr(new sylar::StdoutLogAppender);
+    } else if (name == "stdout_batch") {
+        sylar::StdoutLogAppender::ptr appender(new sylar::StdoutLogAppender);
+        appender->setBatch();
+        return appender;
+    } else if (name == "file") {
+        return sylar::LogAppender::ptr(new sylar::FileLogAppender(file));
+    } else if (name == "file_batch") {
+        sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+        appender->setBatch();
+        return appender;
+    } else if (name == "file_mmap") {
+        return sylar::LogAppender::ptr(new sylar::FileLogAppender(file, 16 * 1024 * 1024));
+    } else if (name == "file_ring") {
+        return sylar::LogAppender::ptr(new sylar::RingLogAppender(file, 4 * 1024 * 1024));
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 运行一个场景, 返回耗时(纳秒)
+ */
+double Run(const Case& c, int threads) {
+    std::string file = s_options.dir + "/sylar_log_bench." + std::to_string(getpid()) + ".log";
+    unlink(file.c_str());
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    logger->setLevel(c.level);
+    sylar::LogFormatter::ptr formatter;
+    if (c.pattern == s_jsonPattern) {
+        formatter.reset(new sylar::JsonLogFormatter);
+    } else {
+        formatter.reset(new sylar::LogFormatter(c.pattern));
+    }
+    // "a+b" adds several appenders sharing one formatter
+    std::vector<sylar::LogAppender::ptr> appenders;
+    size_t begin_pos = 0;
+    while (begin_pos <= c.appender.size()) {
+        size_t end_pos = std::min(c.appender.find('+', begin_pos), c.appender.size());
+        std::string name = c.appender.substr(begin_pos, end_pos - begin_pos);
+        sylar::LogAppender::ptr appender = CreateAppender(name
+                , file + (appenders.empty() ? "" : "." + std::to_string(appenders.size())));
+        appender->setFormatter(formatter);
+        logger->addAppender(appender);
+        appenders.push_back(appender);
+        begin_pos = end_pos + 1;
+    }
+
+    // warm up the call sites, event pools and time caches
+    for (int i = 0; i < 1000; ++ i) {
+        c.call(logger, i);
+    }
+
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++ t) {
+        workers.emplace_back([&]() {
+            ++ ready;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < s_options.calls; ++ i) {
+                c.call(logger, i);
+            }
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& i : workers) {
+        i.join();
+    }
+    // batched appenders only count once their data is written
+    for (auto& appender : appenders) {
+        if (auto stdout_appender = std::dynamic_pointer_cast<sylar::StdoutLogAppender>(appender)) {
+            stdout_appender->flush();
+        } else if (auto file_appender = std::dynamic_pointer_cast<sylar::FileLogAppender>(appender)) {
+            file_appender->flush();
+        } else if (auto ring_appender = std::dynamic_pointer_cast<sylar::RingLogAppender>(appender)) {
+            ring_appender->flush();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < appenders.size(); ++ i) {
+        logger->delAppender(appenders[i]);
+        unlink((file + (i ? "." + std::to_string(i) : "")).c_str());
+    }
+    appenders.clear();
+    return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+std::string JsonEscape(const std::string& str) {
+    std::string rt;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            rt.push_back('\\');
+        }
+        rt.push_back(c);
+    }
+    return rt;
+}
+
+void Usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-n calls_per_thread] [-t max_threads] [-f filter]"
+            " [-d dir] [-o output.json]\n", prog);
+}
+
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++ i) {
+        if (i + 1 >= argc) {
+            Usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            s_options.calls = std::max(1, atoi(argv[++ i]));
+        } else if (strcmp(argv[i], "-t") == 0) {
+            s_options.max_threads = std::max(1, atoi(argv[++ i]));
+        } else if (strcmp(argv[i], "-f") == 0) {
+            s_options.filter = argv[++ i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            s_options.dir = argv[++ i];
+        } else if (strcmp(argv[i], "-o") == 0) {
+            s_options.output = argv[++ i];
+        } else {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Case> cases = {
+        {"disabled/stream", StreamDebug, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"disabled/fmt", FmtDebug, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"enabled/stream", StreamInfo, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"enabled/fmt", FmtInfo, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"enabled/brace", BraceInfo, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"pattern/full", StreamInfo, "null", s_fullPattern, sylar::LogLevel::INFO},
+        {"pattern/default", StreamInfo, "null", s_defaultPattern, sylar::LogLevel::INFO},
+        {"pattern/message", StreamInfo, "null", s_messagePattern, sylar::LogLevel::INFO},
+        {"pattern/kv", StreamKvInfo, "null", s_kvPattern, sylar::LogLevel::INFO},
+        {"pattern/json", StreamKvInfo, "null", s_jsonPattern, sylar::LogLevel::INFO},
+        {"appender/null", StreamInfo, "null", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/stdout", StreamInfo, "stdout", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/stdout_batch", StreamInfo, "stdout_batch", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/file", StreamInfo, "file", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/file_batch", StreamInfo, "file_batch", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/file_mmap", StreamInfo, "file_mmap", s_fullPattern, sylar::LogLevel::INFO},
+        {"appender/file_ring", StreamInfo, "file_ring", s_fullPattern, sylar::LogLevel::INFO},
+        {"fanout/stdout+file", StreamInfo, "stdout_batch+file_batch", s_fullPattern, sylar::LogLevel::INFO},
+        {"fanout/null+stdout+file", StreamInfo, "null+stdout_batch+file_batch", s_fullPattern, sylar::LogLevel::INFO},
+    };
+
+    // stdout appenders write to /dev/null, results go to the original stdout or -o
+    fflush(stdout);
+    int out_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        perror("redirect stdout");
+        return 1;
+    }
+    close(null_fd);
+    FILE* out = s_options.output.empty() ? fdopen(out_fd, "w")
+                : fopen(s_options.output.c_str(), "w");
+    if (!out) {
+        perror(s_options.output.c_str());
+        return 1;
+    }
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < s_options.max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(s_options.max_threads);
+
+    fprintf(out, "{\n  \"benchmark\": \"sylar_log_bench\",\n"
+            "  \"calls_per_thread\": %d,\n  \"results\": [", s_options.calls);
+    bool first = true;
+    for (auto& c : cases) {
+        if (!s_options.filter.empty() && c.name.find(s_options.filter) == std::string::npos) {
+            continue;
+        }
+        for (int threads : thread_counts) {
+            double ns = Run(c, threads);
+            double calls = (double)s_options.calls * threads;
+            double ns_per_call = ns * threads / calls;
+            // disabled calls write no lines
+            double lines_per_sec = c.call == StreamDebug || c.call == FmtDebug ? 0 : calls * 1e9 / ns;
+            fprintf(out, "%s\n    {\"name\": \"%s\", \"appender\": \"%s\", \"pattern\": \"%s\""
+                    ", \"threads\": %d, \"calls\": %.0f, \"ns_per_call\": %.1f"
+                    ", \"lines_per_sec\": %.0f}"
+                    , first ? "" : ",", c.name.c_str(), c.appender.c_str()
+                    , JsonEscape(c.pattern).c_str(), threads, calls, ns_per_call, lines_per_sec);
+            fprintf(stderr, "%-24s threads=%-3d %8.1f ns/call %12.0f lines/s\n"
+                    , c.name.c_str(), threads, ns_per_call, lines_per_sec);
+            first = false;
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * @brief LogFormatter格式化耗时对比
+ * @details 对比返回std::string的旧接口, 直接写入LogBuffer的新接口
+ *          以及编译期解析模板的StaticLogFormatter, 另测量%m{text}/%m{json}转义的吞吐
+ */
+#include "sylar/log.h"
+#include <chrono>
+#include <stdio.h>
+
+static const char* s_patterns[] = {
+    "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n",
+    "%d  [%p] %f %l %m %n",
+    "%m%n",
+};
+
+template<class F>
+static double bench(int n, F f) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++ i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / n;
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    sylar::LogEvent::ptr event(new sylar::LogEvent(logger, sylar::LogLevel::INFO
+                , __FILE__, __LINE__, 0, 1234, 0
+                , std::chrono::microseconds(sylar::GetLogTimeUS()), "main"));
+    event->getSS() << "connection from 10.0.0.1:8080 closed";
+
+    for (auto pattern : s_patterns) {
+        sylar::LogFormatter::ptr fmt(new sylar::LogFormatter(pattern));
+        size_t total = 0;
+        double str_ns = bench(n, [&]() {
+            total += fmt->format(logger, sylar::LogLevel::INFO, event).size();
+        });
+        sylar::LogBuffer buf;
+        double buf_ns = bench(n, [&]() {
+            buf.clear();
+            fmt->format(buf, *logger, sylar::LogLevel::INFO, *event);
+            total += buf.size();
+        });
+        printf("%-60s string: %7.1f ns  buffer: %7.1f ns  (%zu)\n"
+                , pattern, str_ns, buf_ns, total);
+    }
+
+    auto fmt = SYLAR_STATIC_LOG_FORMATTER("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n");
+    sylar::LogBuffer buf;
+    size_t total = 0;
+    double static_ns = bench(n, [&]() {
+        buf.clear();
+        fmt->format(buf, *logger, sylar::LogLevel::INFO, *event);
+        total += buf.size();
+    });
+    printf("%-60s static: %7.1f ns  (%zu)\n", fmt->getPattern().c_str(), static_ns, total);
+
+    // 1KB messages, clean and with a quote every 64 bytes
+    for (int dirty = 0; dirty < 2; ++ dirty) {
+        std::string msg;
+        for (int i = 0; msg.size() < 1024; ++ i) {
+            msg += dirty && i % 8 == 7 ? "key=\"v\" " : "request ";
+        }
+        sylar::LogEvent::ptr e(new sylar::LogEvent(logger, sylar::LogLevel::INFO
+                    , __FILE__, __LINE__, 0, 1234, 0
+                , std::chrono::microseconds(sylar::GetLogTimeUS()), "main"));
+        e->getSS() << msg;
+        for (auto pattern : {"%m", "%m{text}", "%m{json}"}) {
+            sylar::LogFormatter::ptr escape_fmt(new sylar::LogFormatter(pattern));
+            double ns = bench(n / 10, [&]() {
+                buf.clear();
+                escape_fmt->format(buf, *logger, sylar::LogLevel::INFO, *e);
+                total += buf.size();
+            });
+            printf("%-10s %-6s %4zu bytes: %7.1f ns  %6.2f GB/s\n", pattern
+                    , dirty ? "dirty" : "clean", msg.size(), ns, msg.size() / ns);
+        }
+    }
+    return 0;
+}
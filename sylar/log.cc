@@ -1,12 +1,32 @@
 #include "log.h"
 #include <map>
 #include <functional>
+#include <tuple>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <algorithm>
+#include <cmath>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef SYLAR_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 namespace sylar {
      
 const char* LogLevel::ToString(LogLevel::Level level) {
     switch(level) {
-#define XX(name) \ 
+#define XX(name) \
     case LogLevel::name: \
         return #name; \
         break;
@@ -23,188 +43,2943 @@ const char* LogLevel::ToString(LogLevel::Level level) {
     return "UNKNOW";
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
+/**
+ * @brief 返回当前线程复用的格式化缓冲区(已清空)
+ * @param[in,out] own 线程退出时缓冲区已析构, 新建的缓冲区放在这里
+ */
+static LogBuffer& GetThreadLogBuffer(std::unique_ptr<LogBuffer>& own) {
+    LogBuffer& buf = LogThreadLocal<LogBuffer, 0>::Get(own);
+    buf.clear();
+    return buf;
+}
+
+static uint32_t Crc32cTable(uint32_t crc, const char* data, size_t len) {
+    static const auto s_table = []() {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+    for (size_t i = 0; i < len; ++i) {
+        crc = s_table[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(uint32_t crc, const char* data, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        c = __builtin_ia32_crc32di(c, v);
+    }
+    crc = c;
+    for (; len; ++data, --len) {
+        crc = __builtin_ia32_crc32qi(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+// CRC32C, with the SSE4.2 instruction when the cpu has it
+static uint32_t Crc32c(uint32_t crc, const char* data, size_t len) {
+#if defined(__x86_64__)
+    static const bool s_sse42 = __builtin_cpu_supports("sse4.2");
+    if (s_sse42) {
+        return ~Crc32cSse42(~crc, data, len);
+    }
+#endif
+    return ~Crc32cTable(~crc, data, len);
+}
+
+// writev all of iov, resuming after partial writes
+static bool WriteFully(int fd, const struct iovec* iov, int iovcnt) {
+    struct iovec local[IOV_MAX];
+    while (iovcnt > 0) {
+        int cnt = std::min(iovcnt, (int)IOV_MAX);
+        ssize_t n = ::writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (cnt && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+            --cnt;
+        }
+        if (cnt && n) {
+            // partial entry, continue from a patched copy
+            memcpy(local, iov, cnt * sizeof(*iov));
+            local[0].iov_base = (char*)local[0].iov_base + n;
+            local[0].iov_len -= n;
+            if (!WriteFully(fd, local, cnt)) {
+                return false;
+            }
+            iov += cnt;
+            iovcnt -= cnt;
+        }
+    }
+    return true;
+}
+
+// gzip path into path.gz and remove path
+static bool CompressFile(const std::string& path) {
+#ifdef SYLAR_HAVE_ZLIB
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    gzFile out = gzopen((path + ".gz").c_str(), "wb");
+    if (!out) {
+        close(fd);
+        return false;
+    }
+    char buf[64 * 1024];
+    ssize_t n;
+    bool ok = true;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (gzwrite(out, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = gzclose(out) == Z_OK && ok && n == 0;
+    close(fd);
+    if (!ok) {
+        unlink((path + ".gz").c_str());
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+LogStreamBuf::LogStreamBuf() {
+    setp(m_inline, m_inline + INLINE_SIZE);
+}
+
+LogStreamBuf::~LogStreamBuf() {
+    free(m_heap);
+}
+
+void LogStreamBuf::reset() {
+    if (m_heap && (size_t)(epptr() - pbase()) > MAX_KEEP_SIZE) {
+        free(m_heap);
+        m_heap = nullptr;
+        setp(m_inline, m_inline + INLINE_SIZE);
+        return;
+    }
+    setp(pbase(), epptr());
+}
+
+void LogStreamBuf::grow(size_t len) {
+    size_t cap = (epptr() - pbase()) * 2;
+    while (cap < len) {
+        cap *= 2;
+    }
+    size_t used = size();
+    char* data = (char*)malloc(cap);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    memcpy(data, pbase(), used);
+    free(m_heap);
+    m_heap = data;
+    setp(data, data + cap);
+    pbump((int)used);
+}
+
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    *prepare(1) = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n) {
+    memcpy(prepare(n), s, n);
+    pbump((int)n);
+    return n;
+}
+
+LogStream::LogStream()
+    :std::ostream(nullptr) {
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset() {
+    m_buf.reset();
+    clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
+bool LogFields::addString(std::string_view key, std::string_view v) {
+    int offset = alloc(v.size());
+    if (offset < 0) {
+        ++ m_dropped;
+        return false;
+    }
+    memcpy(m_arena + offset, v.data(), v.size());
+    Field f;
+    f.type = STRING;
+    f.s.offset = offset;
+    f.s.length = v.size();
+    if (!addField(key, f)) {
+        m_used = offset;
+        return false;
+    }
+    return true;
+}
+
+bool LogFields::addField(std::string_view key, Field& f) {
+    int offset = key.size() <= UINT8_MAX && m_count < MAX_FIELDS ? alloc(key.size()) : -1;
+    if (offset < 0) {
+        ++ m_dropped;
+        return false;
+    }
+    memcpy(m_arena + offset, key.data(), key.size());
+    f.keyOffset = offset;
+    f.keyLength = key.size();
+    m_fields[m_count ++] = f;
+    return true;
+}
+
+void LogFields::format(LogBuffer& buf) const {
+    for (size_t i = 0; i < m_count; ++ i) {
+        const Field& f = m_fields[i];
+        std::string_view k = key(f);
+        buf.append(' ');
+        buf.append(k.data(), k.size());
+        buf.append('=');
+        switch (f.type) {
+            case INT:
+                buf.appendInt(f.i);
+                break;
+            case UINT:
+                buf.appendUInt(f.u);
+                break;
+            case DOUBLE:
+                buf.appendDouble(f.d);
+                break;
+            case BOOL:
+                buf.append(f.b ? "true" : "false");
+                break;
+            case STRING:
+                buf.append(m_arena + f.s.offset, f.s.length);
+                break;
+        }
+    }
+}
+
+LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
+            , const char* file, int32_t line, uint32_t elapse
+            , uint32_t thread_id, uint32_t fiber_id, std::chrono::microseconds time
+            , const std::string& thread_name)
+    :m_ownSite(new LogCallSite({file, line, "", level, nullptr}))
+    ,m_elapse(elapse)
+    ,m_threadId(thread_id)
+    ,m_fiberId(fiber_id)
+    ,m_time(time.count())
+    ,m_threadName(thread_name)
+    ,m_logger(logger)
+    ,m_level(level) {
+    m_site = m_ownSite.get();
+    m_ss.setFields(&m_fields);
+}
+
+LogEvent::LogEvent(std::shared_ptr<Logger> logger, const LogCallSite& site, LogLevel::Level level
+            , uint32_t elapse, uint32_t thread_id, uint32_t fiber_id
+            , uint64_t time, const std::string& thread_name)
+    :m_site(&site)
+    ,m_elapse(elapse)
+    ,m_threadId(thread_id)
+    ,m_fiberId(fiber_id)
+    ,m_time(time)
+    ,m_threadName(thread_name)
+    ,m_logger(logger)
+    ,m_level(level) {
+    m_ss.setFields(&m_fields);
+}
+
+void LogEvent::reset(std::shared_ptr<Logger> logger, const LogCallSite& site, LogLevel::Level level
+            , uint32_t elapse, uint32_t thread_id, uint32_t fiber_id
+            , uint64_t time, const std::string& thread_name) {
+    m_site = &site;
+    m_ownSite.reset();
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_threadName.assign(thread_name);
+    m_logger = std::move(logger);
+    m_level = level;
+    m_ss.reset();
+    m_fields.clear();
+}
+
+void LogEvent::format(const char* fmt, ...) {
+    va_list al;
+    va_start(al, fmt);
+    format(fmt, al);
+    va_end(al);
+}
+
+void LogEvent::format(const char* fmt, va_list al) {
+    LogStreamBuf& buf = m_ss.buffer();
+    size_t avail = buf.available();
+    va_list ap;
+    va_copy(ap, al);
+    int len = vsnprintf(buf.prepare(0), avail, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= avail) {
+        // vsnprintf needs room for the terminating '\0'
+        len = vsnprintf(buf.prepare(len + 1), len + 1, fmt, al);
+    }
+    buf.commit(len);
+}
+
+// trivially destructible, still readable after the pool's destructor ran
+static thread_local bool t_pool_dead = false;
+
+LogEventPool::~LogEventPool() {
+    t_pool_dead = true;
+}
+
+LogEvent::ptr LogEventPool::Acquire(std::shared_ptr<Logger> logger, const LogCallSite& site
+            , LogLevel::Level level, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            , const std::string& thread_name) {
+    if (t_pool_dead) {
+        return std::make_shared<LogEvent>(std::move(logger), site, level
+                , elapse, thread_id, fiber_id, time, thread_name);
+    }
+    static thread_local LogEventPool t_pool;
+    auto& events = t_pool.m_events;
+    size_t size = events.size();
+    for (size_t n = 0; n < size; ++ n) {
+        size_t i = (t_pool.m_next + n) % size;
+        if (events[i].use_count() == 1) {
+            // pairs with the release decrement of the last outside owner
+            std::atomic_thread_fence(std::memory_order_acquire);
+            events[i]->reset(std::move(logger), site, level, elapse
+                    , thread_id, fiber_id, time, thread_name);
+            t_pool.m_next = i;
+            return events[i];
+        }
+    }
+    LogEvent::ptr event = std::make_shared<LogEvent>(std::move(logger), site, level
+            , elapse, thread_id, fiber_id, time, thread_name);
+    if (size < MAX_EVENTS) {
+        if (events.capacity() == 0) {
+            events.reserve(MAX_EVENTS);
+        }
+        t_pool.m_next = size;
+        event->m_pooled = true;
+        events.push_back(event);
+    }
+    return event;
+}
+
+void LogEventPool::Release(LogEvent::ptr& event) {
+    // no other owner can read the logger any more, the pool reuses it only after our decrement
+    if (event && event.use_count() == (event->m_pooled ? 2 : 1)) {
+        event->m_logger.reset();
+    }
+    event.reset();
+}
+
+LogEventWrap::LogEventWrap(LogEvent::ptr e)
+    :m_event(std::move(e)) {
+}
+
+LogEventWrap::~LogEventWrap() {
+    m_event->getLogger()->log(m_event->getLevel(), m_event);
+    LogEventPool::Release(m_event);
+}
+
+LogStream& LogEventWrap::getSS() {
+    return m_event->getSS();
+}
+
+namespace {
+
+struct LogSiteRule {
+    std::string file;
+    int32_t line;
+    LogCallSite::Mode mode;
+
+    bool match(const LogSiteInfo& info) const {
+        return (line == 0 || line == info.line)
+            && fnmatch(file.c_str(), info.file, 0) == 0;
     }
 };
-class LevelFormatItem : public LogFormatter::FormatItem {
+
+struct LogSiteRegistry {
+    std::vector<LogCallSite*> sites;
+    std::vector<LogSiteRule> rules;
+    std::mutex mutex;
+};
+
+LogSiteRegistry& GetLogSiteRegistry() {
+    static LogSiteRegistry s_registry;
+    return s_registry;
+}
+
+}
+
+bool LogCallSite::registerSite(LogLevel::Level logger_level, LogLevel::Level level) {
+    LogSiteRegistry& registry = GetLogSiteRegistry();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if (m_mode.load(std::memory_order_relaxed) == UNREGISTERED) {
+            Mode mode = DEFAULT;
+            for (auto& i : registry.rules) {
+                if (i.match(info)) {
+                    mode = i.mode;
+                }
+            }
+            m_id = registry.sites.size();
+            registry.sites.push_back(this);
+            m_mode.store(mode, std::memory_order_release);
+        }
+    }
+    return isEnabled(logger_level, level);
+}
+
+void LogCallSite::setMode(Mode mode) {
+    if (m_mode.load(std::memory_order_acquire) == UNREGISTERED) {
+        registerSite(LogLevel::DEBUG, LogLevel::DEBUG);
+    }
+    m_mode.store(mode, std::memory_order_relaxed);
+}
+
+LogCallSite* LogCallSite::Get(uint32_t id) {
+    LogSiteRegistry& registry = GetLogSiteRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return id < registry.sites.size() ? registry.sites[id] : nullptr;
+}
+
+size_t LogCallSite::Control(const std::string& file, int32_t line, Mode mode) {
+    if (mode == UNREGISTERED) {
+        return 0;
+    }
+    LogSiteRegistry& registry = GetLogSiteRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    LogSiteRule rule{file, line, mode};
+    size_t count = 0;
+    for (auto site : registry.sites) {
+        if (rule.match(site->info)) {
+            site->m_mode.store(mode, std::memory_order_relaxed);
+            ++count;
+        }
+    }
+    registry.rules.push_back(std::move(rule));
+    return count;
+}
+
+void LogCallSite::Visit(std::function<void(LogCallSite&)> cb) {
+    LogSiteRegistry& registry = GetLogSiteRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto site : registry.sites) {
+        cb(*site);
+    }
+}
+
+bool LogLimitedSite::takeToken(LogLevel::Level level, const std::shared_ptr<Logger>& logger) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    uint64_t interval = std::max<uint64_t>(1000000000ull / m_n, 1);
+    // a full bucket holds one second worth of tokens
+    uint64_t burst = 1000000000ull - std::min<uint64_t>(interval, 1000000000ull);
+    uint64_t tat = m_state.load(std::memory_order_relaxed);
+    do {
+        uint64_t base = std::max(tat, now);
+        if (base - now > burst) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (m_state.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed)) {
+            break;
+        }
+    } while (true);
+    if (m_suppressed.load(std::memory_order_relaxed)) {
+        uint64_t suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        if (suppressed) {
+            LogEventWrap(LogEventPool::Acquire(logger, *this, level, 0, GetThreadId(), GetFiberId()
+                        , GetLogTimeUS(), Thread::GetName()))
+                .getSS() << "suppressed " << suppressed << " messages";
+        }
+    }
+    return true;
+}
+
+static std::atomic<uint32_t> s_logger_id{0};
+
+namespace {
+
+/**
+ * Sleepable RCU for the appender and logger-name snapshots. Readers bump a
+ * counter of the current epoch on their own cache line. A writer publishes
+ * the new snapshot and retires the old one; retired snapshots are freed once
+ * the epoch has been advanced twice past them, each step waiting for the
+ * readers of the older epoch to be gone. replace() never waits for readers,
+ * so an appender may create loggers or change appenders while it runs;
+ * synchronize() waits for a full grace period. Retired snapshots are freed
+ * only by writers outside any read section, never on the logging path.
+ */
+class LogRcu {
 public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os,Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::ToString(level);
+    static constexpr size_t SHARDS = 64;
+
+    class ReadLock {
+    public:
+        ReadLock() {
+            LogRcu& rcu = LogRcu::Get();
+            m_counter = &rcu.m_slots[Shard()].readers[rcu.m_epoch.load(std::memory_order_relaxed) & 1];
+            // seq_cst, the snapshot load below must not move above it
+            m_counter->fetch_add(1);
+            ++t_depth;
+        }
+        ~ReadLock() {
+            m_counter->fetch_sub(1, std::memory_order_release);
+            --t_depth;
+        }
+    private:
+        friend class LogRcu;
+        std::atomic<int64_t>* m_counter;
+        static thread_local int t_depth;
+    };
+
+    static LogRcu& Get() {
+        // never destroyed, loggers may still run during static destruction
+        static LogRcu* s_rcu = new LogRcu;
+        return *s_rcu;
+    }
+
+    /**
+     * Whether the calling thread is inside a read section, i.e. running
+     * under Logger::log. Waiting for readers there would wait for itself.
+     */
+    static bool InReadSection() {
+        return ReadLock::t_depth > 0;
+    }
+
+    /**
+     * Publish val into ptr; the old value is deleted once no reader can
+     * still see it. Never waits for readers.
+     */
+    template<class T>
+    void replace(std::atomic<T*>& ptr, typename std::common_type<T*>::type val) {
+        T* old = ptr.exchange(val);
+        if (old) {
+            std::lock_guard<std::mutex> lock(m_retiredMutex);
+            m_retired.push_back({const_cast<void*>(static_cast<const void*>(old))
+                                , &Delete<T>, m_epoch.load(std::memory_order_relaxed)});
+        }
+        if (!InReadSection()) {
+            reclaim();
+        }
+    }
+
+    /**
+     * Wait until every reader that could see a snapshot replaced before
+     * this call has left, then free the retired snapshots. Must not be
+     * called inside a read section.
+     */
+    void synchronize() {
+        {
+            std::lock_guard<std::mutex> lock(m_syncMutex);
+            advance(true);
+            advance(true);
+        }
+        reclaim();
+    }
+private:
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    template<class T>
+    static void Delete(void* ptr) {
+        delete static_cast<T*>(ptr);
+    }
+
+    /**
+     * Move to the next epoch once the readers of the previous one are
+     * gone, needs m_syncMutex. Returns false if wait is false and readers
+     * remain.
+     */
+    bool advance(bool wait) {
+        uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        while (readers((epoch + 1) & 1)) {
+            if (!wait) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        m_epoch.store(epoch + 1);
+        return true;
+    }
+
+    /**
+     * Advance the epoch as far as the readers allow and free what became
+     * unreachable. Never waits for readers.
+     */
+    void reclaim() {
+        std::vector<Retired> ready;
+        {
+            std::unique_lock<std::mutex> sync_lock(m_syncMutex, std::try_to_lock);
+            if (!sync_lock.owns_lock()) {
+                // a concurrent synchronize() frees them when it is done
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_retiredMutex);
+            for (int i = 0; i < 2 && !m_retired.empty()
+                    && m_epoch.load(std::memory_order_relaxed) < m_retired.back().epoch + 2; ++i) {
+                if (!advance(false)) {
+                    break;
+                }
+            }
+            uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+            auto it = m_retired.begin();
+            while (it != m_retired.end() && epoch >= it->epoch + 2) {
+                ++it;
+            }
+            ready.assign(m_retired.begin(), it);
+            m_retired.erase(m_retired.begin(), it);
+        }
+        // deleters may drop appenders, keep them off the locks
+        for (auto& i : ready) {
+            i.deleter(i.ptr);
+        }
+    }
+
+    static size_t Shard() {
+        static std::atomic<size_t> s_next{0};
+        static thread_local size_t s_shard = s_next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return s_shard;
+    }
+
+    int64_t readers(uint32_t epoch) const {
+        int64_t sum = 0;
+        for (auto& i : m_slots) {
+            sum += i.readers[epoch].load();
+        }
+        return sum;
+    }
+private:
+    struct alignas(64) Slot {
+        std::atomic<int64_t> readers[2] = {{0}, {0}};
+    };
+    Slot m_slots[SHARDS];
+    std::atomic<uint64_t> m_epoch{0};
+    std::vector<Retired> m_retired;
+    // held while the epoch advances, synchronize() keeps it while it waits
+    std::mutex m_syncMutex;
+    // guards m_retired only, replace() inside a read section takes just this one
+    std::mutex m_retiredMutex;
+};
+
+thread_local int LogRcu::ReadLock::t_depth = 0;
+
+}
+
+// guards parent/child links and inherited levels
+static std::mutex& HierarchyMutex() {
+    static std::mutex s_mutex;
+    return s_mutex;
+}
+
+Logger::Logger(const std::string& name) 
+    :m_name(name)
+    ,m_appenders(new std::vector<LogAppender::ptr>)
+    ,m_id(s_logger_id++) {
+        
+    m_formatter.reset(new LogFormatter("%d  [%p] %f %l %m %n"));
+}
+
+Logger::~Logger() {
+    if (m_parent) {
+        std::lock_guard<std::mutex> lock(HierarchyMutex());
+        auto& siblings = m_parent->m_children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+    }
+    delete m_appenders.load();
+}
+
+void Logger::setLevel(LogLevel::Level val) {
+    std::lock_guard<std::mutex> lock(HierarchyMutex());
+    m_levelSet = true;
+    m_level.store(val, std::memory_order_relaxed);
+    propagateLevel();
+}
+
+void Logger::resetLevel() {
+    std::lock_guard<std::mutex> lock(HierarchyMutex());
+    if (!m_parent) {
+        return;
+    }
+    m_levelSet = false;
+    m_level.store(m_parent->getLevel(), std::memory_order_relaxed);
+    propagateLevel();
+}
+
+void Logger::propagateLevel() {
+    for (auto child : m_children) {
+        if (!child->m_levelSet) {
+            child->m_level.store(getLevel(), std::memory_order_relaxed);
+            child->propagateLevel();
+        }
+    }
+}
+
+void Logger::setBinaryWriter(std::shared_ptr<BinaryLogWriter> writer) {
+    std::lock_guard<std::mutex> lock(m_binaryMutex);
+    if (writer) {
+        m_binaryWriters.push_back(writer);
+    }
+    m_binaryWriter.store(writer.get(), std::memory_order_release);
+}
+
+void Logger::addAppender(LogAppender::ptr appender) {
+    if (!appender->getFormatter()) {
+        appender->setFormatter(m_formatter);
+    }
+    std::lock_guard<std::mutex> lock(m_appenderMutex);
+    auto list = new std::vector<LogAppender::ptr>(*m_appenders.load());
+    list->push_back(appender);
+    LogRcu::Get().replace(m_appenders, list);
+}
+void Logger::delAppender(LogAppender::ptr appender) {
+    {
+        std::lock_guard<std::mutex> lock(m_appenderMutex);
+        auto list = new std::vector<LogAppender::ptr>(*m_appenders.load());
+        for (auto it = list->begin();
+                it != list->end(); ++ it)
+            if (*it == appender) {
+                list->erase(it);
+                break;
+            }
+        LogRcu::Get().replace(m_appenders, list);
+    }
+    // inside Logger::log the wait would include this thread's own log() call
+    if (!LogRcu::InReadSection()) {
+        LogRcu::Get().synchronize();
+    }
+}
+
+void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
+    // distinct formatters rendered once per event
+    static const size_t s_max_formats = 4;
+    struct Rendered {
+        const LogFormatter* formatter;
+        size_t offset;
+        size_t size;
+    };
+    static thread_local int t_depth = 0;
+
+    if (level >= getLevel() || event->getSite().getMode() == LogCallSite::ON) {
+        m_metrics.accept(level);
+        auto self = shared_from_this();
+        // appenders that log again from inside write()/log() format on their own
+        struct DepthGuard {
+            DepthGuard() { ++ t_depth; }
+            ~DepthGuard() { -- t_depth; }
+        } guard;
+        bool fanout = t_depth == 1;
+        Rendered rendered[s_max_formats];
+        size_t count = 0;
+        std::unique_ptr<LogBuffer> own;
+        LogBuffer& t_buf = LogThreadLocal<LogBuffer, 1>::Get(own);
+        if (fanout) {
+            t_buf.clear();
+        }
+        {
+            LogRcu::ReadLock lock;
+            for (Logger* logger = this; logger; logger = logger->m_parent.get()) {
+                for (auto& i : *logger->m_appenders.load()) {
+                    if (!i->accepts(level)) {
+                        continue;
+                    }
+                    const LogFormatter* formatter = i->getFormatterPtr();
+                    if (!fanout || !formatter || !i->acceptsFormatted()) {
+                        i->log(self, level, event);
+                        continue;
+                    }
+                    size_t n = 0;
+                    while (n < count && rendered[n].formatter != formatter) {
+                        ++ n;
+                    }
+                    if (n == count) {
+                        if (count == s_max_formats) {
+                            i->log(self, level, event);
+                            continue;
+                        }
+                        bool sample = LogMetrics::Sample();
+                        uint64_t begin = sample ? LogMetrics::Now() : 0;
+                        size_t offset = t_buf.size();
+                        formatter->format(t_buf, *this, level, *event);
+                        if (sample) {
+                            m_metrics.record(LogMetrics::FORMAT, LogMetrics::Now() - begin);
+                        }
+                        rendered[count ++] = Rendered{formatter, offset, t_buf.size() - offset};
+                    }
+                    i->write(level, *event, t_buf.data() + rendered[n].offset, rendered[n].size);
+                }
+            }
+        }
+        // queued and batched appenders may still hold it, outside the read lock since this waits
+        if (fanout && level == LogLevel::FATAL) {
+            LogCrashHandler::FlushOnFatal();
+        }
+    } else {
+        m_metrics.filter(level);
+    }
+}
+
+std::vector<LogMetrics::Snapshot> Logger::getMetrics() const {
+    std::vector<LogMetrics::Snapshot> metrics(1);
+    metrics[0].name = m_name;
+    m_metrics.snapshot(metrics[0]);
+    LogRcu::ReadLock lock;
+    for (auto& i : *m_appenders.load()) {
+        metrics.push_back(i->getMetrics());
+    }
+    return metrics;
+}
+    
+void Logger::debug(LogEvent::ptr event) {
+    log(LogLevel::DEBUG, event);
+}
+void Logger::info(LogEvent::ptr event) {       
+    log(LogLevel::INFO, event);
+}
+void Logger::warn(LogEvent::ptr event) {       
+    log(LogLevel::WARN, event);
+}
+
+void Logger::error(LogEvent::ptr event) {       
+    log(LogLevel::ERROR, event);
+}
+    
+void Logger::fatal(LogEvent::ptr event) {       
+    log(LogLevel::FATAL, event);
+}
+ 
+LogFile::LogFile(const std::string& filename, size_t segment_size) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        m_size = st.st_size;
+    }
+    if (segment_size) {
+        m_mmap.reset(new MmapFileWriter(filename, segment_size));
+    } else {
+        m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+}
+
+LogFile::~LogFile() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool LogFile::write(const char* data, size_t len) {
+    if (m_mmap) {
+        return m_mmap->write(data, len);
+    }
+    while (len) {
+        ssize_t n = ::write(m_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool LogFile::writev(const struct iovec* iov, int iovcnt) {
+    if (m_mmap) {
+        for (int i = 0; i < iovcnt; ++i) {
+            if (!m_mmap->write((const char*)iov[i].iov_base, iov[i].iov_len)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return WriteFully(m_fd, iov, iovcnt);
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename, size_t segment_size)
+    :m_filename(filename)
+    ,m_segmentSize(segment_size) {
+    reopen();
+    LogCrashHandler::Register(this, LogCrashFlushable::BUFFER);
+}
+
+FileLogAppender::~FileLogAppender() {
+    LogCrashHandler::Unregister(this);
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cond.notify_one();
+        m_thread.join();
+    }
+}
+
+void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& buf = GetThreadLogBuffer(own);
+    m_formatter->format(buf, *logger, level, *event);
+    if (sample) {
+        m_metrics.record(LogMetrics::FORMAT, LogMetrics::Now() - begin);
+    }
+    write(level, *event, buf.data(), buf.size());
+}
+
+void FileLogAppender::write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    if (m_batch) {
+        m_batch->append(data, len, level >= LogLevel::FATAL);
+    } else {
+        LogFile::ptr file = std::atomic_load(&m_file);
+        if (file) {
+            file->write(data, len);
+        }
+    }
+    if (sample) {
+        m_metrics.record(LogMetrics::WRITE, LogMetrics::Now() - begin);
+    }
+    m_metrics.accept(level);
+    m_metrics.addBytes(len);
+    uint64_t size = m_size.fetch_add(len, std::memory_order_relaxed) + len;
+    uint64_t max_size = m_maxSize.load(std::memory_order_relaxed);
+    uint64_t next = m_nextRotate.load(std::memory_order_relaxed);
+    if ((max_size && size >= max_size) || (next && event.getTimeUS() >= next)) {
+        rotate();
+    }
+}
+
+LogMetrics::Snapshot FileLogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "file:" + m_filename;
+    m_metrics.snapshot(snapshot);
+    return snapshot;
+}
+
+bool FileLogAppender::reopen() {
+    if (m_segmentSize) {
+        // two mappings of the same file would truncate each other, close first
+        LogFile::ptr old = std::atomic_exchange(&m_file, LogFile::ptr());
+        m_fd.store(-1);
+        while (old && old.use_count() > 1) {
+            std::this_thread::yield();
+        }
+    }
+    LogFile::ptr file(new LogFile(m_filename, m_segmentSize));
+    m_size.store(file->getSize(), std::memory_order_relaxed);
+    // crash writes must never see the fd of a closed file
+    m_fd.store(file->getFd());
+    std::atomic_store(&m_file, file);
+    return file->isOpen();
+}
+
+void FileLogAppender::setRotate(uint64_t max_size, uint32_t interval, uint32_t max_files, bool compress) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_maxSize.store(max_size, std::memory_order_relaxed);
+    m_interval = interval;
+    m_maxFiles = max_files;
+    m_compress = compress;
+    m_nextRotate.store(interval ? NextRotateTime(GetLogTimeUS(), interval) : 0, std::memory_order_relaxed);
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&FileLogAppender::run, this);
+    }
+}
+
+void FileLogAppender::setBatch(size_t max_bytes, uint32_t linger_ms) {
+    if (m_segmentSize) {
+        return;
+    }
+    m_batch.reset(new BatchLogWriter([this](const struct iovec* iov, int iovcnt) {
+        LogFile::ptr file = std::atomic_load(&m_file);
+        return file && file->writev(iov, iovcnt);
+    }, max_bytes, linger_ms));
+}
+
+void FileLogAppender::flush() {
+    if (m_batch) {
+        m_batch->flush();
+    }
+}
+
+void FileLogAppender::crashFlush(uint64_t deadline, const char* record, size_t len) {
+    int fd = m_fd.load(std::memory_order_relaxed);
+    if (m_batch) {
+        m_batch->crashFlush(fd, deadline);
+    }
+    if (record && fd >= 0) {
+        struct iovec iov{(void*)record, len};
+        WriteFully(fd, &iov, 1);
+    }
+}
+
+void FileLogAppender::rotate() {
+    if (m_rotating.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // a manual rotation without a policy starts the thread on demand
+        if (!m_thread.joinable()) {
+            m_thread = std::thread(&FileLogAppender::run, this);
+        }
+    }
+    m_cond.notify_one();
+}
+
+uint64_t FileLogAppender::NextRotateTime(uint64_t now_us, uint32_t interval) {
+    time_t now = now_us / 1000000;
+    struct tm tm;
+    localtime_r(&now, &tm);
+    int64_t local = now + tm.tm_gmtoff;
+    return (uint64_t)((local / interval + 1) * interval - tm.tm_gmtoff) * 1000000;
+}
+
+void FileLogAppender::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cond.wait(lock, [this]() { return m_stopping || m_rotating.load(); });
+        if (m_stopping) {
+            break;
+        }
+        uint32_t interval = m_interval;
+        uint32_t max_files = m_maxFiles;
+        bool compress = m_compress;
+        // writers take m_mutex in rotate(), never hold it across file work
+        lock.unlock();
+        doRotate(interval, max_files, compress);
+        lock.lock();
+    }
+}
+
+void FileLogAppender::doRotate(uint32_t interval, uint32_t max_files, bool compress) {
+    uint64_t now = GetLogTimeUS();
+    time_t sec = now / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), ".%Y%m%d-%H%M%S", &tm);
+    std::string archive;
+    struct stat st;
+    for (int i = 0; i == 0 || stat(archive.c_str(), &st) == 0
+            || stat((archive + ".gz").c_str(), &st) == 0; ++i) {
+        char seq[16];
+        snprintf(seq, sizeof(seq), ".%03d", i);
+        archive = m_filename + stamp + seq;
+    }
+
+    // batched records belong to the file being archived
+    if (m_batch) {
+        m_batch->flush();
+    }
+    // writes racing with the swap still land in the renamed file
+    bool renamed = rename(m_filename.c_str(), archive.c_str()) == 0;
+    LogFile::ptr file(new LogFile(m_filename, m_segmentSize));
+    if (file->isOpen()) {
+        m_size.store(file->getSize(), std::memory_order_relaxed);
+        m_fd.store(file->getFd());
+        file = std::atomic_exchange(&m_file, file);
+    }
+    if (interval) {
+        m_nextRotate.store(NextRotateTime(now, interval), std::memory_order_relaxed);
+    }
+    m_rotating.store(false);
+
+    // wait for stragglers so the archive is complete before compressing it
+    while (file.use_count() > 1) {
+        std::this_thread::yield();
+    }
+    file.reset();
+    if (renamed && compress) {
+        CompressFile(archive);
+    }
+    if (max_files) {
+        prune(max_files);
+    }
+}
+
+void FileLogAppender::prune(uint32_t max_files) {
+    std::string dir = ".";
+    std::string base = m_filename;
+    size_t pos = m_filename.rfind('/');
+    if (pos != std::string::npos) {
+        dir = m_filename.substr(0, pos ? pos : 1);
+        base = m_filename.substr(pos + 1);
+    }
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    // archives are named base.YYYYmmdd-HHMMSS.NNN[.gz], name order is age order
+    std::vector<std::string> archives;
+    while (struct dirent* e = readdir(d)) {
+        const char* name = e->d_name;
+        if (strncmp(name, base.c_str(), base.size()) == 0
+                && name[base.size()] == '.' && isdigit((unsigned char)name[base.size() + 1])) {
+            archives.push_back(name);
+        }
+    }
+    closedir(d);
+    if (archives.size() <= max_files) {
+        return;
+    }
+    std::sort(archives.begin(), archives.end());
+    for (size_t i = 0; i < archives.size() - max_files; ++i) {
+        unlink((dir + "/" + archives[i]).c_str());
+    }
+}
+
+MmapFileWriter::MmapFileWriter(const std::string& filename, size_t segment_size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    m_segmentSize = (std::max(segment_size, page) + page - 1) / page * page;
+    m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        return;
+    }
+    // the first segment starts at the page holding the current end of file
+    uint64_t offset = st.st_size / page * page;
+    Segment* seg = map(offset);
+    if (seg) {
+        seg->cursor.store(st.st_size - offset, std::memory_order_relaxed);
+        m_current.store(seg, std::memory_order_release);
+    } else {
+        m_end.store(st.st_size, std::memory_order_relaxed);
+        m_direct.store(true, std::memory_order_release);
+    }
+}
+
+MmapFileWriter::~MmapFileWriter() {
+    Segment* seg = m_current.exchange(nullptr);
+    if (seg) {
+        while (seg->inflight.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        size_t used = std::min(seg->cursor.load(), m_segmentSize);
+        munmap(seg->base, m_segmentSize);
+        if (ftruncate(m_fd, seg->offset + used) != 0) {
+            // keeps the preallocated tail, readers see trailing zeros
+        }
+    } else if (m_direct.load()) {
+        // a failed map may have preallocated past the data
+        if (ftruncate(m_fd, m_end.load()) != 0) {
+            // keeps the preallocated tail, readers see trailing zeros
+        }
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+MmapFileWriter::Segment* MmapFileWriter::map(uint64_t offset) {
+    if (fallocate(m_fd, 0, offset, m_segmentSize) != 0) {
+        // filesystems without fallocate, a mapping beyond EOF would SIGBUS
+        struct stat st;
+        if (fstat(m_fd, &st) != 0
+                || ((uint64_t)st.st_size < offset + m_segmentSize
+                    && ftruncate(m_fd, offset + m_segmentSize) != 0)) {
+            return nullptr;
+        }
+    }
+    void* base = mmap(nullptr, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    Segment* seg;
+    if (!m_free.empty()) {
+        // inflight is left alone, a late writer may still be backing out of it
+        seg = m_free.back();
+        m_free.pop_back();
+    } else {
+        m_segments.emplace_back(new Segment);
+        seg = m_segments.back().get();
+    }
+    seg->base = (char*)base;
+    seg->offset.store(offset, std::memory_order_relaxed);
+    return seg;
+}
+
+void MmapFileWriter::roll(Segment* old, const char* tail, size_t tail_len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t offset = old->offset + m_segmentSize;
+    Segment* seg = map(offset);
+    // a record longer than a segment fills whole segments before the last one
+    while (seg && tail_len >= m_segmentSize) {
+        memcpy(seg->base, tail, m_segmentSize);
+        munmap(seg->base, m_segmentSize);
+        seg->base = nullptr;
+        m_free.push_back(seg);
+        tail += m_segmentSize;
+        tail_len -= m_segmentSize;
+        offset += m_segmentSize;
+        seg = map(offset);
+    }
+    if (seg) {
+        if (tail_len) {
+            memcpy(seg->base, tail, tail_len);
+        }
+        seg->cursor.store(tail_len, std::memory_order_relaxed);
+    } else {
+        // out of address space or mappings, keep logging through pwrite
+        m_end.store(offset, std::memory_order_relaxed);
+        writeDirect(tail, tail_len);
+        m_direct.store(true, std::memory_order_release);
+    }
+    m_current.store(seg);
+    while (old->inflight.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    munmap(old->base, m_segmentSize);
+    old->base = nullptr;
+    m_free.push_back(old);
+}
+
+bool MmapFileWriter::write(const char* data, size_t len) {
+    if (len == 0) {
+        return isOpen();
+    }
+    for (;;) {
+        Segment* seg = m_current.load(std::memory_order_acquire);
+        if (!seg) {
+            return m_direct.load(std::memory_order_acquire) && writeDirect(data, len);
+        }
+        seg->inflight.fetch_add(1);
+        if (m_current.load() != seg) {
+            // lost a race with roll(), the segment may already be unmapped
+            seg->inflight.fetch_sub(1, std::memory_order_release);
+            continue;
+        }
+        size_t begin = seg->cursor.fetch_add(len, std::memory_order_relaxed);
+        size_t end = begin + len;
+        if (end <= m_segmentSize) {
+            memcpy(seg->base + begin, data, len);
+            seg->inflight.fetch_sub(1, std::memory_order_release);
+            if (end == m_segmentSize) {
+                roll(seg, nullptr, 0);
+            }
+            return true;
+        }
+        if (begin < m_segmentSize) {
+            // exactly one writer straddles the end and publishes the next segment
+            size_t head = m_segmentSize - begin;
+            memcpy(seg->base + begin, data, head);
+            seg->inflight.fetch_sub(1, std::memory_order_release);
+            roll(seg, data + head, len - head);
+            return true;
+        }
+        // the struct may come back as a later segment, wait for a different one
+        uint64_t offset = seg->offset.load(std::memory_order_relaxed);
+        seg->inflight.fetch_sub(1, std::memory_order_release);
+        while (m_current.load(std::memory_order_acquire) == seg
+                && seg->offset.load(std::memory_order_relaxed) == offset) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool MmapFileWriter::writeDirect(const char* data, size_t len) {
+    uint64_t offset = m_end.fetch_add(len);
+    while (len) {
+        ssize_t n = pwrite(m_fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+ 
+void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& buf = GetThreadLogBuffer(own);
+    m_formatter->format(buf, *logger, level, *event);
+    if (sample) {
+        m_metrics.record(LogMetrics::FORMAT, LogMetrics::Now() - begin);
+    }
+    write(level, *event, buf.data(), buf.size());
+}
+
+void StdoutLogAppender::write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    if (m_batch) {
+        m_batch->append(data, len, level >= LogLevel::FATAL);
+    } else {
+        std::cout.write(data, len);
+    }
+    if (sample) {
+        m_metrics.record(LogMetrics::WRITE, LogMetrics::Now() - begin);
+    }
+    m_metrics.accept(level);
+    m_metrics.addBytes(len);
+}
+
+LogMetrics::Snapshot StdoutLogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "stdout";
+    m_metrics.snapshot(snapshot);
+    return snapshot;
+}
+
+StdoutLogAppender::~StdoutLogAppender() {
+    LogCrashHandler::Unregister(this);
+}
+
+void StdoutLogAppender::setBatch(size_t max_bytes, uint32_t linger_ms) {
+    std::cout.flush();
+    bool first = !m_batch;
+    m_batch.reset(new BatchLogWriter([](const struct iovec* iov, int iovcnt) {
+        return WriteFully(STDOUT_FILENO, iov, iovcnt);
+    }, max_bytes, linger_ms));
+    if (first) {
+        LogCrashHandler::Register(this, LogCrashFlushable::BUFFER);
+    }
+}
+
+void StdoutLogAppender::flush() {
+    if (m_batch) {
+        m_batch->flush();
+    }
+}
+
+void StdoutLogAppender::crashFlush(uint64_t deadline, const char* record, size_t len) {
+    // the record already went to stderr
+    if (m_batch) {
+        m_batch->crashFlush(STDOUT_FILENO, deadline);
+    }
+}
+
+namespace {
+
+const int s_crash_signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE};
+const size_t s_crash_signal_count = sizeof(s_crash_signals) / sizeof(s_crash_signals[0]);
+struct sigaction s_crash_old[s_crash_signal_count];
+std::atomic<LogCrashFlushable*> s_crash_registry[2][LogCrashHandler::MAX_FLUSHABLES];
+// the overflow warning is printed once per process
+std::atomic<bool> s_crash_overflow{false};
+// serializes Install/Uninstall
+std::mutex s_crash_mutex;
+std::atomic<bool> s_crash_installed{false};
+std::atomic<bool> s_crash_fatal{false};
+std::atomic<uint32_t> s_crash_timeout{1000};
+std::atomic<bool> s_crash_flushing{false};
+// Flush() calls walking the registry, Unregister waits for them to leave
+std::atomic<int> s_crash_inflight{0};
+// the first fatal signal, the watchdog re-raises it
+std::atomic<int> s_crash_signal{0};
+std::atomic<bool> s_crash_done{false};
+
+// fixed size text, the signal handler must not allocate
+struct CrashText {
+    char data[256];
+    size_t size = 0;
+
+    void append(const char* str, size_t len) {
+        len = std::min(len, sizeof(data) - size);
+        memcpy(data + size, str, len);
+        size += len;
+    }
+
+    void append(const char* str) {
+        append(str, strlen(str));
+    }
+
+    void appendUInt(uint64_t v, size_t width = 0) {
+        char tmp[20];
+        size_t n = LogBuffer::FormatUInt(tmp, v);
+        while (width > n) {
+            append("0", 1);
+            -- width;
+        }
+        append(tmp, n);
+    }
+
+    void appendHex(uint64_t v) {
+        char tmp[16];
+        size_t n = 0;
+        do {
+            tmp[15 - n ++] = "0123456789abcdef"[v & 15];
+            v >>= 4;
+        } while (v);
+        append("0x", 2);
+        append(tmp + 16 - n, n);
+    }
+};
+
+const char* CrashSignalName(int sig) {
+    switch (sig) {
+#define XX(name) \
+        case name: \
+            return #name;
+        XX(SIGSEGV);
+        XX(SIGABRT);
+        XX(SIGBUS);
+        XX(SIGFPE);
+#undef XX
+    }
+    return "UNKNOWN";
+}
+
+// restore the action Install replaced and deliver sig to it once we return
+void CrashReraise(int sig) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    for (size_t i = 0; i < s_crash_signal_count; ++ i) {
+        // an ignored fault would only fault again
+        if (s_crash_signals[i] == sig && s_crash_old[i].sa_handler != SIG_IGN) {
+            sa = s_crash_old[i];
+        }
+    }
+    sigaction(sig, &sa, nullptr);
+    raise(sig);
+}
+
+// the flush is stuck, die with the default action of the original signal
+void CrashAlarmHandler(int) {
+    int sig = s_crash_signal.load();
+    signal(sig, SIG_DFL);
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    sigprocmask(SIG_UNBLOCK, &set, nullptr);
+    raise(sig);
+    _exit(128 + sig);
+}
+
+void CrashSignalHandler(int sig, siginfo_t* info, void*) {
+    int first = 0;
+    if (!s_crash_signal.compare_exchange_strong(first, sig)) {
+        // another thread is flushing, the watchdog bounds this wait
+        while (!s_crash_done.load()) {
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, nullptr);
+        }
+        CrashReraise(sig);
+        return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = CrashAlarmHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, nullptr);
+    alarm(s_crash_timeout.load() / 1000 + 2);
+
+    uint64_t now = GetLogTimeUS();
+    CrashText text;
+    text.append("*** sylar: fatal signal ");
+    text.appendUInt(sig);
+    text.append(" (");
+    text.append(CrashSignalName(sig));
+    text.append(")");
+    if (sig != SIGABRT) {
+        text.append(" at ");
+        text.appendHex((uintptr_t)info->si_addr);
+    }
+    text.append(", thread ");
+    text.appendUInt(GetThreadId());
+    const std::string& name = Thread::GetName();
+    if (!name.empty()) {
+        text.append(" (");
+        text.append(name.c_str(), name.size());
+        text.append(")");
+    }
+    text.append(", fiber ");
+    text.appendUInt(GetFiberId());
+    text.append(", time ");
+    text.appendUInt(now / 1000000);
+    text.append(".");
+    text.appendUInt(now % 1000000, 6);
+    text.append(" ***\n");
+    struct iovec iov{text.data, text.size};
+    WriteFully(STDERR_FILENO, &iov, 1);
+
+    LogCrashHandler::Flush(text.data, text.size);
+    s_crash_done.store(true);
+    alarm(0);
+    CrashReraise(sig);
+}
+
+}
+
+bool LogCrashHandler::Install(uint32_t timeout_ms, bool flush_on_fatal) {
+    std::lock_guard<std::mutex> lock(s_crash_mutex);
+    s_crash_timeout.store(std::max(timeout_ms, 1u));
+    s_crash_fatal.store(flush_on_fatal);
+    if (s_crash_installed.load()) {
+        return true;
+    }
+    // a stack overflow faults on the thread stack, handle it on a spare one
+    stack_t ss;
+    if (sigaltstack(nullptr, &ss) == 0 && (ss.ss_flags & SS_DISABLE)) {
+        static const size_t s_stack_size = 64 * 1024;
+        // never freed, the stack stays registered with the thread
+        ss.ss_sp = new char[s_stack_size];
+        ss.ss_size = s_stack_size;
+        ss.ss_flags = 0;
+        sigaltstack(&ss, nullptr);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = CrashSignalHandler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    for (int sig : s_crash_signals) {
+        sigaddset(&sa.sa_mask, sig);
+    }
+    for (size_t i = 0; i < s_crash_signal_count; ++ i) {
+        if (sigaction(s_crash_signals[i], &sa, &s_crash_old[i]) != 0) {
+            while (i --) {
+                sigaction(s_crash_signals[i], &s_crash_old[i], nullptr);
+            }
+            return false;
+        }
+    }
+    s_crash_installed.store(true);
+    return true;
+}
+
+void LogCrashHandler::Uninstall() {
+    std::lock_guard<std::mutex> lock(s_crash_mutex);
+    if (!s_crash_installed.load()) {
+        return;
+    }
+    for (size_t i = 0; i < s_crash_signal_count; ++ i) {
+        sigaction(s_crash_signals[i], &s_crash_old[i], nullptr);
+    }
+    s_crash_installed.store(false);
+    s_crash_fatal.store(false);
+}
+
+bool LogCrashHandler::IsInstalled() {
+    return s_crash_installed.load();
+}
+
+void LogCrashHandler::Flush(const char* record, size_t len) {
+    uint64_t deadline = Now() + s_crash_timeout.load(std::memory_order_relaxed) * 1000000ull;
+    // one flush at a time; past the deadline go ahead anyway, the owner may be this thread
+    bool owner = !s_crash_flushing.exchange(true);
+    while (!owner && Now() < deadline) {
+        sched_yield();
+        owner = !s_crash_flushing.exchange(true);
+    }
+    // seq_cst against Unregister: either it sees the count or this sees the cleared slot
+    s_crash_inflight.fetch_add(1);
+    for (auto& stage : s_crash_registry) {
+        for (auto& slot : stage) {
+            LogCrashFlushable* flushable = slot.load();
+            if (flushable) {
+                flushable->crashFlush(deadline, record, len);
+            }
+        }
+    }
+    s_crash_inflight.fetch_sub(1);
+    if (owner) {
+        s_crash_flushing.store(false);
+    }
+}
+
+void LogCrashHandler::FlushOnFatal() {
+    if (s_crash_fatal.load(std::memory_order_relaxed)) {
+        Flush();
+    }
+}
+
+bool LogCrashHandler::Register(LogCrashFlushable* flushable, LogCrashFlushable::Stage stage) {
+    for (auto& slot : s_crash_registry[stage]) {
+        LogCrashFlushable* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, flushable)) {
+            return true;
+        }
+    }
+    if (!s_crash_overflow.exchange(true)) {
+        std::cerr << "LogCrashHandler: more than " << MAX_FLUSHABLES
+                  << " objects registered for one stage, the rest are not flushed on crash"
+                  << std::endl;
+    }
+    return false;
+}
+
+void LogCrashHandler::Unregister(LogCrashFlushable* flushable) {
+    for (auto& stage : s_crash_registry) {
+        for (auto& slot : stage) {
+            LogCrashFlushable* expected = flushable;
+            slot.compare_exchange_strong(expected, nullptr);
+        }
+    }
+    // a flush that loaded the slot before it was cleared may still be using the object;
+    // crashFlush() gives up at its deadline, so this wait is bounded
+    while (s_crash_inflight.load()) {
+        sched_yield();
+    }
+}
+
+uint64_t LogCrashHandler::Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool LogCrashHandler::TryLock(std::mutex& mutex, uint64_t deadline) {
+    while (!mutex.try_lock()) {
+        if (Now() >= deadline) {
+            return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+BatchLogWriter::BatchLogWriter(Sink sink, size_t max_bytes, uint32_t linger_ms)
+    :m_sink(sink)
+    ,m_maxBytes(std::max(max_bytes, (size_t)1))
+    ,m_linger(linger_ms) {
+    m_thread = std::thread(&BatchLogWriter::run, this);
+}
+
+BatchLogWriter::~BatchLogWriter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+    flush();
+}
+
+void BatchLogWriter::append(const char* data, size_t len, bool flush_now) {
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_active.bytes == 0) {
+            m_cond.notify_one();
+        }
+        m_active.bytes += len;
+        while (len) {
+            if (m_active.count == 0 || m_active.tail == CHUNK_SIZE) {
+                if (m_active.count == m_active.chunks.size()) {
+                    m_active.chunks.emplace_back(new char[CHUNK_SIZE]);
+                }
+                ++m_active.count;
+                m_active.tail = 0;
+            }
+            size_t n = std::min(len, CHUNK_SIZE - m_active.tail);
+            memcpy(m_active.chunks[m_active.count - 1].get() + m_active.tail, data, n);
+            m_active.tail += n;
+            data += n;
+            len -= n;
+        }
+        full = m_active.bytes >= m_maxBytes;
+    }
+    if (full || flush_now) {
+        flush();
+    }
+}
+
+void BatchLogWriter::flush() {
+    std::lock_guard<std::mutex> flush_lock(m_flushMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_active.bytes == 0) {
+            return;
+        }
+        std::swap(m_active, m_flushing);
+        m_active.count = 0;
+        m_active.tail = 0;
+        m_active.bytes = 0;
+    }
+    m_iov.resize(m_flushing.count);
+    for (size_t i = 0; i < m_flushing.count; ++i) {
+        m_iov[i].iov_base = m_flushing.chunks[i].get();
+        m_iov[i].iov_len = i + 1 == m_flushing.count ? m_flushing.tail : CHUNK_SIZE;
+    }
+    m_sink(&m_iov[0], m_iov.size());
+}
+
+void BatchLogWriter::crashFlush(int fd, uint64_t deadline) {
+    static const size_t s_max_iov = 64;
+    // a flush in progress finishes before the active buffer is taken
+    if (fd < 0 || !LogCrashHandler::TryLock(m_flushMutex, deadline)) {
+        return;
+    }
+    if (LogCrashHandler::TryLock(m_mutex, deadline)) {
+        struct iovec iov[s_max_iov];
+        size_t n = 0;
+        for (size_t i = 0; i < m_active.count; ++i) {
+            iov[n].iov_base = m_active.chunks[i].get();
+            iov[n].iov_len = i + 1 == m_active.count ? m_active.tail : CHUNK_SIZE;
+            if (++n == s_max_iov || i + 1 == m_active.count) {
+                WriteFully(fd, iov, n);
+                n = 0;
+            }
+        }
+        m_active.count = 0;
+        m_active.tail = 0;
+        m_active.bytes = 0;
+        m_mutex.unlock();
+    }
+    m_flushMutex.unlock();
+}
+
+void BatchLogWriter::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        if (m_active.bytes == 0) {
+            m_cond.wait(lock);
+            continue;
+        }
+        // records are at most linger old when the wait ends
+        m_cond.wait_for(lock, std::chrono::milliseconds(m_linger),
+                        [this]() { return m_stopping; });
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+AsyncLogAppender::AsyncLogAppender(size_t capacity, size_t batch)
+    :m_batch(batch ? batch : 1) {
+    size_t n = 2;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    m_mask = n - 1;
+    m_cells.reset(new Cell[n]);
+    for (size_t i = 0; i < n; ++ i) {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    m_pending.reserve(m_batch);
+    m_thread = std::thread(&AsyncLogAppender::run, this);
+    LogCrashHandler::Register(this, LogCrashFlushable::QUEUE);
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    LogCrashHandler::Unregister(this);
+    m_stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    m_thread.join();
+}
+
+void AsyncLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &m_cells[pos & m_mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+    cell->item.logger = std::move(logger);
+    cell->item.level = level;
+    cell->item.event = std::move(event);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    m_metrics.accept(level);
+    if (sample) {
+        m_metrics.record(LogMetrics::WRITE, LogMetrics::Now() - begin);
+    }
+
+    // only the producer that flips the flag pays for the wakeup
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)
+            && m_sleeping.exchange(false)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+LogMetrics::Snapshot AsyncLogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "async";
+    m_metrics.snapshot(snapshot);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_relaxed);
+    snapshot.queueDepth = tail > head ? tail - head : 0;
+    snapshot.dropped = getDropped();
+    return snapshot;
+}
+
+void AsyncLogAppender::addAppender(LogAppender::ptr appender) {
+    std::lock_guard<std::mutex> lock(m_appendersMutex);
+    m_appenders.push_back(appender);
+}
+
+void AsyncLogAppender::delAppender(LogAppender::ptr appender) {
+    std::lock_guard<std::mutex> lock(m_appendersMutex);
+    for (auto it = m_appenders.begin();
+            it != m_appenders.end(); ++ it) {
+        if (*it == appender) {
+            m_appenders.erase(it);
+            break;
+        }
+    }
+}
+
+void AsyncLogAppender::flush() {
+    size_t target = m_tail.load(std::memory_order_acquire);
+    while (m_head.load(std::memory_order_acquire) < target) {
+        if (m_sleeping.exchange(false)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+        std::this_thread::yield();
+    }
+}
+
+void AsyncLogAppender::crashFlush(uint64_t deadline, const char* record, size_t len) {
+    if (m_writerTid.load() == GetThreadId()) {
+        return;
+    }
+    // the writer rechecks the queue at least every 100ms, no need to wake it
+    size_t target = m_tail.load(std::memory_order_acquire);
+    while (m_head.load(std::memory_order_acquire) < target && LogCrashHandler::Now() < deadline) {
+        sched_yield();
+    }
+}
+
+size_t AsyncLogAppender::drain() {
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    while (m_pending.size() < m_batch) {
+        Cell& cell = m_cells[pos & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+        m_pending.push_back(std::move(cell.item));
+        cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+        ++ pos;
+    }
+    size_t n = m_pending.size();
+    if (n == 0) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_appendersMutex);
+        for (auto& i : m_appenders) {
+            if (!i->getFormatter()) {
+                i->setFormatter(m_formatter);
+            }
+        }
+        for (auto& item : m_pending) {
+            for (auto& i : m_appenders) {
+                i->log(item.logger, item.level, item.event);
+            }
+            LogEventPool::Release(item.event);
+        }
+    }
+    m_pending.clear();
+    m_head.store(pos, std::memory_order_release);
+    return n;
+}
+
+void AsyncLogAppender::run() {
+    m_writerTid.store(GetThreadId());
+    for (;;) {
+        if (drain()) {
+            continue;
+        }
+        if (m_stopping.load()) {
+            if (drain() == 0) {
+                break;
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.store(true);
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        if (m_cells[pos & m_mask].seq.load() != pos + 1
+                && !m_stopping.load()) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        m_sleeping.store(false);
+    }
+}
+
+LogBuffer::LogBuffer(size_t capacity)
+    :m_capacity(capacity ? capacity : 1) {
+    m_data = (char*)malloc(m_capacity);
+}
+
+LogBuffer::~LogBuffer() {
+    free(m_data);
+}
+
+uint64_t LogMetrics::Snapshot::percentile(Stage stage, double p) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        total += latency[stage][i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += latency[stage][i];
+        if (seen >= rank) {
+            return 2ull << i;
+        }
+    }
+    return 2ull << (BUCKETS - 1);
+}
+
+void LogMetrics::snapshot(Snapshot& snapshot) const {
+    for (auto& shard : m_shards) {
+        for (size_t i = 0; i < LEVELS; ++i) {
+            snapshot.accepted[i] += shard.accepted[i].load(std::memory_order_relaxed);
+            snapshot.filtered[i] += shard.filtered[i].load(std::memory_order_relaxed);
+        }
+        snapshot.bytes += shard.bytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < STAGES; ++i) {
+            for (size_t j = 0; j < BUCKETS; ++j) {
+                snapshot.latency[i][j] += shard.latency[i][j].load(std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+size_t LogMetrics::NextShard() {
+    static std::atomic<size_t> s_next{0};
+    return s_next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+}
+
+LogMetrics::Snapshot LogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "appender";
+    m_metrics.snapshot(snapshot);
+    return snapshot;
+}
+
+RingLogAppender::Ring::Ring(size_t size, uint64_t owner)
+    :owner(owner)
+    ,m_data(new char[size])
+    ,m_mask(size - 1) {
+}
+
+bool RingLogAppender::Ring::push(uint64_t time, const char* data, size_t len) {
+    size_t size = m_mask + 1;
+    size_t need = (sizeof(Header) + len + 7) & ~(size_t)7;
+    if (need > size / 2) {
+        return false;
+    }
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    size_t idx = pos & m_mask;
+    size_t room = size - idx;
+    size_t total = room < need ? room + need : need;
+    if (pos + total - headCache > size) {
+        headCache = head.load(std::memory_order_acquire);
+        if (pos + total - headCache > size) {
+            return false;
+        }
+    }
+    if (room < need) {
+        // room is a multiple of 8, enough for the marker
+        uint32_t wrap = WRAP;
+        memcpy(m_data.get() + idx, &wrap, sizeof(wrap));
+        pos += room;
+        idx = 0;
+    }
+    Header header{(uint32_t)len, 0, time};
+    memcpy(m_data.get() + idx, &header, sizeof(header));
+    memcpy(m_data.get() + idx + sizeof(header), data, len);
+    tail.store(pos + need, std::memory_order_release);
+    return true;
+}
+
+const RingLogAppender::Ring::Header* RingLogAppender::Ring::read(uint64_t& pos) const {
+    size_t idx = pos & m_mask;
+    const Header* header = (const Header*)(m_data.get() + idx);
+    if (header->len == WRAP) {
+        pos += m_mask + 1 - idx;
+        header = (const Header*)m_data.get();
+    }
+    pos += (sizeof(Header) + header->len + 7) & ~(size_t)7;
+    return header;
+}
+
+static std::atomic<uint64_t> s_ring_serial{0};
+
+RingLogAppender::RingLogAppender(const std::string& filename, size_t ring_size)
+    :m_filename(filename)
+    ,m_serial(++ s_ring_serial) {
+    m_ringSize = 4096;
+    while (m_ringSize < ring_size) {
+        m_ringSize <<= 1;
+    }
+    reopen();
+    m_thread = std::thread(&RingLogAppender::run, this);
+    LogCrashHandler::Register(this, LogCrashFlushable::BUFFER);
+}
+
+RingLogAppender::~RingLogAppender() {
+    LogCrashHandler::Unregister(this);
+    m_stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    m_thread.join();
+}
+
+bool RingLogAppender::reopen() {
+    LogFile::ptr file(new LogFile(m_filename));
+    m_fd.store(file->getFd());
+    std::atomic_store(&m_file, file);
+    return file->isOpen();
+}
+
+RingLogAppender::Ring* RingLogAppender::getRing() {
+    // trivially destructible, still valid after t_holder is gone
+    static thread_local Ring* t_last = nullptr;
+    static thread_local bool t_exited = false;
+    struct Holder {
+        std::vector<Ring::ptr> rings;
+
+        ~Holder() {
+            for (auto& i : rings) {
+                i->closed.store(true, std::memory_order_release);
+            }
+            t_last = nullptr;
+            t_exited = true;
+        }
+    };
+    static thread_local Holder t_holder;
+    if (t_exited) {
+        return nullptr;
+    }
+    if (t_last && t_last->owner == m_serial) {
+        return t_last;
+    }
+    for (auto& i : t_holder.rings) {
+        if (i->owner == m_serial) {
+            return t_last = i.get();
+        }
+    }
+    // rings only we still hold belong to destroyed appenders
+    t_last = nullptr;
+    t_holder.rings.erase(std::remove_if(t_holder.rings.begin(), t_holder.rings.end()
+                , [](const Ring::ptr& r) { return r.use_count() == 1; })
+            , t_holder.rings.end());
+    Ring::ptr ring = std::make_shared<Ring>(m_ringSize, m_serial);
+    {
+        std::lock_guard<std::mutex> lock(m_ringsMutex);
+        m_rings.push_back(ring);
+        m_ringsChanged.store(true);
+    }
+    t_holder.rings.push_back(ring);
+    return t_last = ring.get();
+}
+
+void RingLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& buf = GetThreadLogBuffer(own);
+    m_formatter->format(buf, *logger, level, *event);
+    if (sample) {
+        m_metrics.record(LogMetrics::FORMAT, LogMetrics::Now() - begin);
+    }
+    write(level, *event, buf.data(), buf.size());
+}
+
+void RingLogAppender::write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    bool sample = LogMetrics::Sample();
+    uint64_t begin = sample ? LogMetrics::Now() : 0;
+    Ring* ring = getRing();
+    if (!ring) {
+        // logging from a thread_local destructor after our ring was closed
+        LogFile::ptr file = std::atomic_load(&m_file);
+        if (file) {
+            file->write(data, len);
+        }
+    } else if (!ring->push(event.getTimeUS(), data, len)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (sample) {
+        m_metrics.record(LogMetrics::WRITE, LogMetrics::Now() - begin);
+    }
+    m_metrics.accept(level);
+    m_metrics.addBytes(len);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)
+            && m_sleeping.exchange(false)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+void RingLogAppender::flush() {
+    std::vector<std::pair<Ring::ptr, uint64_t>> targets;
+    {
+        std::lock_guard<std::mutex> lock(m_ringsMutex);
+        for (auto& i : m_rings) {
+            targets.emplace_back(i, i->tail.load(std::memory_order_acquire));
+        }
+    }
+    for (auto& i : targets) {
+        while (i.first->head.load(std::memory_order_acquire) < i.second) {
+            if (m_sleeping.exchange(false)) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cond.notify_one();
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+void RingLogAppender::crashFlush(uint64_t deadline, const char* record, size_t len) {
+    static const size_t s_max_rings = 64;
+    static const size_t s_max_records = 64;
+    int fd = m_fd.load(std::memory_order_relaxed);
+    // park the writer between two rounds, unless the crash is in the writer itself
+    m_crashing.store(true);
+    uint32_t tid = GetThreadId();
+    while (m_draining.load() && m_writerTid.load() != tid) {
+        if (LogCrashHandler::Now() >= deadline) {
+            // stuck in a write, writing the same records again would not help
+            m_crashing.store(false);
+            return;
+        }
+        sched_yield();
+    }
+    if (fd >= 0 && LogCrashHandler::TryLock(m_ringsMutex, deadline)) {
+        // merge up to s_max_rings rings at a time by time, without allocating
+        for (size_t base = 0; base < m_rings.size(); base += s_max_rings) {
+            size_t n = std::min(m_rings.size() - base, s_max_rings);
+            uint64_t pos[s_max_rings];
+            uint64_t end[s_max_rings];
+            for (size_t i = 0; i < n; ++ i) {
+                pos[i] = m_rings[base + i]->head.load(std::memory_order_relaxed);
+                end[i] = m_rings[base + i]->tail.load(std::memory_order_acquire);
+            }
+            struct iovec iov[s_max_records];
+            size_t count = 0;
+            for (;;) {
+                size_t min = n;
+                uint64_t min_time = 0;
+                for (size_t i = 0; i < n; ++ i) {
+                    uint64_t next = pos[i];
+                    if (next < end[i]) {
+                        uint64_t time = m_rings[base + i]->read(next)->time;
+                        if (min == n || time < min_time) {
+                            min = i;
+                            min_time = time;
+                        }
+                    }
+                }
+                if (min == n || count == s_max_records) {
+                    WriteFully(fd, iov, count);
+                    count = 0;
+                    if (min == n) {
+                        break;
+                    }
+                }
+                const Ring::Header* header = m_rings[base + min]->read(pos[min]);
+                iov[count ++] = iovec{(void*)(header + 1), header->len};
+            }
+            for (size_t i = 0; i < n; ++ i) {
+                m_rings[base + i]->head.store(pos[i], std::memory_order_release);
+            }
+        }
+        m_ringsMutex.unlock();
+    }
+    if (record && fd >= 0) {
+        struct iovec iov{(void*)record, len};
+        WriteFully(fd, &iov, 1);
+    }
+    m_crashing.store(false);
+}
+
+LogMetrics::Snapshot RingLogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "ring:" + m_filename;
+    m_metrics.snapshot(snapshot);
+    snapshot.dropped = getDropped();
+    return snapshot;
+}
+
+void RingLogAppender::run() {
+    m_writerTid.store(GetThreadId());
+    for (;;) {
+        if (drain()) {
+            continue;
+        }
+        if (m_stopping.load()) {
+            if (drain() == 0) {
+                break;
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.store(true);
+        bool pending = m_ringsChanged.load();
+        for (auto& i : m_active) {
+            pending = pending || i->tail.load() != i->head.load(std::memory_order_relaxed);
+        }
+        // a crash flush owns the rings, wait for it instead of spinning
+        if ((!pending || m_crashing.load()) && !m_stopping.load()) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        m_sleeping.store(false);
+    }
+}
+
+size_t RingLogAppender::drain() {
+    // at most this many records per writev
+    static const size_t s_max_records = IOV_MAX;
+    // a crash flush takes over the rings between two rounds
+    struct DrainGuard {
+        DrainGuard(std::atomic<bool>& flag) :flag(flag) { flag.store(true); }
+        ~DrainGuard() { flag.store(false); }
+        std::atomic<bool>& flag;
+    } guard(m_draining);
+    if (m_crashing.load()) {
+        return 0;
+    }
+    if (m_ringsChanged.exchange(false)) {
+        std::lock_guard<std::mutex> lock(m_ringsMutex);
+        m_active = m_rings;
+    }
+    size_t n = m_active.size();
+    m_cursors.resize(n);
+    m_heap.clear();
+    auto greater = std::greater<std::pair<uint64_t, size_t>>();
+    for (size_t i = 0; i < n; ++ i) {
+        uint64_t pos = m_active[i]->head.load(std::memory_order_relaxed);
+        uint64_t end = m_active[i]->tail.load(std::memory_order_acquire);
+        m_cursors[i] = std::make_pair(pos, end);
+        if (pos < end) {
+            m_heap.emplace_back(m_active[i]->read(pos)->time, i);
+        }
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), greater);
+
+    // merge the ring heads by time, writing straight from ring memory
+    m_iov.clear();
+    while (!m_heap.empty() && m_iov.size() < s_max_records) {
+        std::pop_heap(m_heap.begin(), m_heap.end(), greater);
+        size_t i = m_heap.back().second;
+        m_heap.pop_back();
+        auto& cursor = m_cursors[i];
+        const Ring::Header* header = m_active[i]->read(cursor.first);
+        m_iov.push_back(iovec{(void*)(header + 1), header->len});
+        if (cursor.first < cursor.second) {
+            uint64_t pos = cursor.first;
+            m_heap.emplace_back(m_active[i]->read(pos)->time, i);
+            std::push_heap(m_heap.begin(), m_heap.end(), greater);
+        }
+    }
+    if (!m_iov.empty()) {
+        LogFile::ptr file = std::atomic_load(&m_file);
+        if (file) {
+            file->writev(m_iov.data(), m_iov.size());
+        }
+    }
+    for (size_t i = 0; i < n; ++ i) {
+        m_active[i]->head.store(m_cursors[i].first, std::memory_order_release);
+    }
+
+    // the closed flag is set after the last push, so tail is final once it is seen
+    bool reclaim = false;
+    for (auto& i : m_active) {
+        if (i->closed.load(std::memory_order_acquire)
+                && i->head.load(std::memory_order_relaxed) == i->tail.load(std::memory_order_acquire)) {
+            reclaim = true;
+            break;
+        }
+    }
+    if (reclaim) {
+        std::lock_guard<std::mutex> lock(m_ringsMutex);
+        auto done = [](const Ring::ptr& r) {
+            return r->closed.load(std::memory_order_acquire)
+                && r->head.load(std::memory_order_relaxed) == r->tail.load(std::memory_order_acquire);
+        };
+        m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(), done), m_rings.end());
+        m_active = m_rings;
+        m_ringsChanged.store(false);
+    }
+    return m_iov.size();
+}
+
+DedupLogAppender::DedupLogAppender(LogAppender::ptr appender, uint32_t window_ms, size_t slots)
+    :m_appender(appender)
+    ,m_window(window_ms * 1000ull)
+    ,m_slots(slots ? slots : 1) {
+}
+
+DedupLogAppender::~DedupLogAppender() {
+    flush();
+}
+
+void DedupLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        m_metrics.filter(level);
+        return;
+    }
+    m_metrics.accept(level);
+    const LogCallSite* site = &event->getSite();
+    if (site->getMode() == LogCallSite::UNREGISTERED) {
+        // events built from file/line own their site, it does not outlive them
+        m_appender->log(logger, level, event);
+        return;
+    }
+    std::string_view content = event->getContentView();
+    uint32_t hash = Crc32c((uint32_t)(uintptr_t)site, content.data(), content.size());
+    uint64_t now = event->getTimeUS();
+    std::vector<Summary> summaries;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (now >= m_nextSweep) {
+            // runs whose slot is never hit again still get their summary
+            m_nextSweep = now + m_window;
+            for (auto& i : m_slots) {
+                if (i.count && now >= i.time + m_window) {
+                    summarize(i, summaries);
+                }
+            }
+        }
+        Slot& slot = m_slots[hash % m_slots.size()];
+        if (slot.site == site && slot.hash == hash && slot.level == level
+                && now - slot.time < m_window
+                && slot.content == content) {
+            ++slot.count;
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            event = nullptr;
+        } else {
+            summarize(slot, summaries);
+            slot.hash = hash;
+            slot.site = site;
+            slot.content.assign(content.data(), content.size());
+            slot.time = now;
+            slot.logger = logger;
+            slot.level = level;
+            if (!m_appender->getFormatter()) {
+                m_appender->setFormatter(m_formatter);
+            }
+        }
+    }
+    // the wrapped appender does its I/O without holding m_mutex
+    for (auto& i : summaries) {
+        m_appender->log(i.logger, i.level, i.event);
+    }
+    if (event) {
+        m_appender->log(logger, level, event);
+    }
+}
+
+LogMetrics::Snapshot DedupLogAppender::getMetrics() const {
+    LogMetrics::Snapshot snapshot;
+    snapshot.name = "dedup";
+    m_metrics.snapshot(snapshot);
+    snapshot.dropped = getSuppressed();
+    return snapshot;
+}
+
+void DedupLogAppender::flush() {
+    std::vector<Summary> summaries;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& i : m_slots) {
+            summarize(i, summaries);
+        }
+    }
+    for (auto& i : summaries) {
+        m_appender->log(i.logger, i.level, i.event);
+    }
+}
+
+void DedupLogAppender::summarize(Slot& slot, std::vector<Summary>& out) {
+    if (slot.count == 0) {
+        return;
+    }
+    LogEvent::ptr event = LogEventPool::Acquire(slot.logger, *slot.site, slot.level, 0, GetThreadId()
+            , GetFiberId(), GetLogTimeUS(), Thread::GetName());
+    event->getSS() << "last message repeated " << slot.count << " times";
+    slot.count = 0;
+    out.push_back({slot.logger, slot.level, event});
+}
+
+LoggerManager::LoggerManager() {
+    m_root.reset(new Logger);
+    m_root->m_levelSet = true;
+    m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
+    auto loggers = new LoggerMap;
+    (*loggers)[m_root->getName()] = m_root;
+    m_loggers.store(loggers);
+}
+
+LoggerManager::~LoggerManager() {
+    delete m_loggers.load();
+}
+
+Logger::ptr LoggerManager::lookup(std::string_view name) const {
+    LogRcu::ReadLock lock;
+    const LoggerMap* loggers = m_loggers.load();
+    auto it = loggers->find(name);
+    return it == loggers->end() ? nullptr : it->second;
+}
+
+Logger::ptr LoggerManager::getLogger(const std::string& name) {
+    if (name.empty()) {
+        return m_root;
+    }
+    Logger::ptr logger = lookup(name);
+    if (logger) {
+        return logger;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_ptr<LoggerMap> loggers(new LoggerMap(*m_loggers.load()));
+    logger = create(*loggers, name);
+    LogRcu::Get().replace(m_loggers, loggers.release());
+    return logger;
+}
+
+Logger::ptr LoggerManager::create(LoggerMap& loggers, std::string_view name) {
+    auto it = loggers.find(name);
+    if (it != loggers.end()) {
+        return it->second;
+    }
+    size_t pos = name.rfind('.');
+    Logger::ptr parent = (pos == std::string_view::npos || pos == 0)
+                         ? m_root : create(loggers, name.substr(0, pos));
+    Logger::ptr logger(new Logger(std::string(name)));
+    {
+        std::lock_guard<std::mutex> lock(HierarchyMutex());
+        logger->m_parent = parent;
+        logger->m_level.store(parent->getLevel(), std::memory_order_relaxed);
+        parent->m_children.push_back(logger.get());
+    }
+    loggers.emplace(name, logger);
+    return logger;
+}
+
+void LogBuffer::grow(size_t len) {
+    size_t cap = m_capacity * 2;
+    while (cap < len) {
+        cap *= 2;
+    }
+    char* data = (char*)realloc(m_data, cap);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    m_data = data;
+    m_capacity = cap;
+}
+
+namespace {
+
+/**
+ * @brief 一个时间格式在某一秒的格式化结果
+ */
+struct TimeFormatCache {
+    /// 最多缓存的毫秒/微秒字段数
+    static const size_t MAX_FRACS = 4;
+
+    /// 缓存对应的秒, -1表示无效
+    uint64_t sec = (uint64_t)-1;
+    /// 时间格式
+    char fmt[64];
+    uint32_t fmtLen = 0;
+    /// 格式化结果, 毫秒/微秒位置先留空
+    char out[128];
+    uint32_t outLen = 0;
+    /// 毫秒/微秒字段在out中的位置和位数(3或6)
+    uint16_t fracPos[MAX_FRACS];
+    uint8_t fracDigits[MAX_FRACS];
+    uint8_t fracs = 0;
+};
+
+/**
+ * @brief 按fmt格式化sec到cache, 失败返回false
+ */
+bool RenderTime(TimeFormatCache& cache, const char* fmt, uint32_t len, uint64_t sec) {
+    time_t t = sec;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    cache.outLen = 0;
+    cache.fracs = 0;
+    char seg[sizeof(cache.fmt) + 1];
+    size_t seg_begin = 0;
+    for (size_t i = 0; i <= len; ++ i) {
+        int digits = 0;
+        if (i < len) {
+            if (fmt[i] != '%' || i + 1 >= len) {
+                continue;
+            }
+            if (fmt[i + 1] == 'L') {
+                digits = 3;
+            } else if (fmt[i + 1] == 'f') {
+                digits = 6;
+            } else {
+                // skips the conversion char, so "%%L" stays literal
+                ++ i;
+                continue;
+            }
+        }
+        size_t seg_len = i - seg_begin;
+        if (seg_len) {
+            memcpy(seg, fmt + seg_begin, seg_len);
+            seg[seg_len] = '\0';
+            size_t n = strftime(cache.out + cache.outLen, sizeof(cache.out) - cache.outLen, seg, &tm);
+            if (n == 0) {
+                return false;
+            }
+            cache.outLen += n;
+        }
+        if (digits) {
+            if (cache.fracs == TimeFormatCache::MAX_FRACS
+                    || cache.outLen + digits > sizeof(cache.out)) {
+                return false;
+            }
+            cache.fracPos[cache.fracs] = cache.outLen;
+            cache.fracDigits[cache.fracs] = digits;
+            ++ cache.fracs;
+            cache.outLen += digits;
+        }
+        seg_begin = i + 2;
+        ++ i;
+    }
+    memcpy(cache.fmt, fmt, len);
+    cache.fmtLen = len;
+    cache.sec = sec;
+    return true;
+}
+
+}
+
+void LogFormatter::FormatTime(LogBuffer& buf, const char* fmt, uint32_t len, uint64_t time_us) {
+    static const char* s_default = "%Y:%m:%d %H:%M:%S";
+    static thread_local TimeFormatCache t_caches[4];
+    if (len == 0) {
+        fmt = s_default;
+        len = strlen(s_default);
+    }
+    uint64_t sec = time_us / 1000000;
+    if (len > sizeof(t_caches[0].fmt)) {
+        buf.appendUInt(sec);
+        return;
+    }
+    TimeFormatCache& cache = t_caches[((uintptr_t)fmt >> 4) & 3];
+    if (cache.sec != sec || cache.fmtLen != len
+            || memcmp(cache.fmt, fmt, len) != 0) {
+        if (!RenderTime(cache, fmt, len, sec)) {
+            cache.sec = (uint64_t)-1;
+            buf.appendUInt(sec);
+            return;
+        }
+    }
+    char* p = buf.reserve(cache.outLen);
+    memcpy(p, cache.out, cache.outLen);
+    uint32_t frac = time_us % 1000000;
+    for (uint8_t i = 0; i < cache.fracs; ++ i) {
+        uint32_t v = cache.fracDigits[i] == 3 ? frac / 1000 : frac;
+        char* d = p + cache.fracPos[i] + cache.fracDigits[i];
+        for (uint8_t n = 0; n < cache.fracDigits[i]; ++ n) {
+            *-- d = '0' + v % 10;
+            v /= 10;
+        }
     }
-};
+    buf.commit(cache.outLen);
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }
-};
+namespace {
 
-class NameFormatItem : public LogFormatter::FormatItem {
-public:
-    NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << logger->getName();
+/**
+ * @brief 逐字节查找第一个需要转义的字节, 没有时返回len
+ */
+size_t FindEscapeScalar(const char* str, size_t len, LogFormatter::Escape mode) {
+    static const auto s_tables = []() {
+        std::array<std::array<bool, 256>, 2> tables{};
+        for (int c = 0; c < 0x20; ++ c) {
+            tables[0][c] = tables[1][c] = true;
+        }
+        tables[0][0x7f] = true;
+        tables[1]['"'] = tables[1]['\\'] = true;
+        return tables;
+    }();
+    const auto& table = s_tables[mode == LogFormatter::ESCAPE_JSON];
+    for (size_t i = 0; i < len; ++ i) {
+        if (table[(uint8_t)str[i]]) {
+            return i;
+        }
     }
-};
+    return len;
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
+#if defined(__x86_64__)
+// the SIMD scanners finish with one overlapping load instead of a scalar tail
+size_t FindEscapeSse2(const char* str, size_t len, LogFormatter::Escape mode) {
+    if (len < 16) {
+        return FindEscapeScalar(str, len, mode);
     }
-};
-
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
+    bool json = mode == LogFormatter::ESCAPE_JSON;
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    const __m128i a = _mm_set1_epi8(json ? '"' : 0x7f);
+    const __m128i b = _mm_set1_epi8(json ? '\\' : 0x7f);
+    // x <= 0x1f, or x is one of the two mode specific bytes
+    auto scan = [&](size_t pos) -> uint32_t {
+        __m128i x = _mm_loadu_si128((const __m128i*)(str + pos));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x)
+                , _mm_or_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(x, b)));
+        return _mm_movemask_epi8(m);
+    };
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint32_t mask = scan(i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
     }
-};
+    if (i < len) {
+        uint32_t mask = scan(len - 16) >> (i - (len - 16));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return len;
+}
 
-class DataTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DataTimeFormatItem(const std::string& format = "%Y:%m:%d %H:%M:%S")
-        :m_format(format) {
+__attribute__((target("avx2")))
+size_t FindEscapeAvx2(const char* str, size_t len, LogFormatter::Escape mode) {
+    if (len < 32) {
+        return FindEscapeSse2(str, len, mode);
     }
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getTime();
+    bool json = mode == LogFormatter::ESCAPE_JSON;
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+    const __m256i a = _mm256_set1_epi8(json ? '"' : 0x7f);
+    const __m256i b = _mm256_set1_epi8(json ? '\\' : 0x7f);
+    auto scan = [&](size_t pos) __attribute__((target("avx2"))) -> uint32_t {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(str + pos));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, ctrl), x)
+                , _mm256_or_si256(_mm256_cmpeq_epi8(x, a), _mm256_cmpeq_epi8(x, b)));
+        return _mm256_movemask_epi8(m);
+    };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint32_t mask = scan(i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
     }
-private:
-    std::string m_format;
-};
-
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
+    if (i < len) {
+        uint32_t mask = scan(len - 32) >> (i - (len - 32));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
     }
+    return len;
+}
+#endif
 
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
-    }
-};
-
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
+size_t LogFormatter::FindEscape(const char* str, size_t len, Escape mode, EscapeScanner scanner) {
+    if (scanner == SCAN_SCALAR) {
+        return FindEscapeScalar(str, len, mode);
     }
-};
-
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(std::string& str)
-        : m_string(str) { }
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
+#if defined(__x86_64__)
+    static const bool s_avx2 = __builtin_cpu_supports("avx2");
+    if (scanner == SCAN_SSE2) {
+        return FindEscapeSse2(str, len, mode);
     }
-private:
-    std::string m_string;
-};
-Logger::Logger(const std::string& name) 
-    :m_name(name) {       
-        
-    m_formatter.reset(new LogFormatter("%d  [%p] %f %l %m %n"));
+    return s_avx2 ? FindEscapeAvx2(str, len, mode) : FindEscapeSse2(str, len, mode);
+#else
+    return FindEscapeScalar(str, len, mode);
+#endif
 }
 
-void Logger::addAppender(LogAppender::ptr appender) {
-    if (!appender->getFormatter()) {
-        appender->setFormatter(m_formatter);
+void LogFormatter::AppendEscaped(LogBuffer& buf, const char* str, size_t len, Escape mode) {
+    static const char* s_hex = "0123456789abcdef";
+    if (mode == ESCAPE_NONE) {
+        buf.append(str, len);
+        return;
     }
-    m_appenders.push_back(appender);
-}
-void Logger::delAppender(LogAppender::ptr appender) {
-    for (auto it = m_appenders.begin();
-            it != m_appenders.end(); ++ it)
-        if (*it == appender) {
-            m_appenders.erase(it);
+    while (true) {
+        size_t n = FindEscape(str, len, mode);
+        buf.append(str, n);
+        if (n == len) {
             break;
         }
-}
-
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        auto self = shared_from_this();
-        for (auto& i : m_appenders) {
-            i->log(self, level, event);
+        unsigned char c = str[n];
+        str += n + 1;
+        len -= n + 1;
+        char* p = buf.reserve(6);
+        p[0] = '\\';
+        switch (c) {
+            case '"':  p[1] = '"';  break;
+            case '\\': p[1] = '\\'; break;
+            case '\n': p[1] = 'n';  break;
+            case '\r': p[1] = 'r';  break;
+            case '\t': p[1] = 't';  break;
+            default:
+                if (mode == ESCAPE_JSON) {
+                    memcpy(p + 1, "u00", 3);
+                    p[4] = s_hex[c >> 4];
+                    p[5] = s_hex[c & 0xf];
+                    buf.commit(6);
+                } else {
+                    p[1] = 'x';
+                    p[2] = s_hex[c >> 4];
+                    p[3] = s_hex[c & 0xf];
+                    buf.commit(4);
+                }
+                continue;
         }
+        buf.commit(2);
     }
 }
-    
-void Logger::debug(LogEvent::ptr event) {
-    log(LogLevel::DEBUG, event);
-}
-void Logger::info(LogEvent::ptr event) {       
-    log(LogLevel::INFO, event);
-}
-void Logger::warn(LogEvent::ptr event) {       
-    log(LogLevel::WARN, event);
-}
 
-void Logger::error(LogEvent::ptr event) {       
-    log(LogLevel::ERROR, event);
-}
-    
-void Logger::fatal(LogEvent::ptr event) {       
-    log(LogLevel::FATAL, event);
+LogFormatter::LogFormatter(const std::string& pattern) 
+    :m_pattern(pattern) {
+    init();
 }
- 
-FileLogAppender::FileLogAppender(const std::string& filename) {
+
+std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& t_buf = LogThreadLocal<LogBuffer, 2>::Get(own);
+    t_buf.clear();
+    format(t_buf, *logger, level, *event);
+    return t_buf.toString();
 }
 
-void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        m_filestream << m_formatter->format(logger, level, event);
-    }
+std::ostream& LogFormatter::format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& t_buf = LogThreadLocal<LogBuffer, 2>::Get(own);
+    t_buf.clear();
+    format(t_buf, *logger, level, *event);
+    return os.write(t_buf.data(), t_buf.size());
 }
 
-bool FileLogAppender::reopen() {
-    if (m_filestream) {
-        m_filestream.close();
+void LogFormatter::format(LogBuffer& buf, const Logger& logger, LogLevel::Level level, const LogEvent& event) const {
+    const char* literals = m_literals.data();
+    for (auto& op : m_ops) {
+        switch (op.code) {
+#define XX(C) \
+        case C: \
+            ExecuteOp<C>(buf, literals + op.offset, op.length, logger, level, event); \
+            break;
+
+        XX(OP_LITERAL);
+        XX(OP_MESSAGE);
+        XX(OP_LEVEL);
+        XX(OP_ELAPSE);
+        XX(OP_NAME);
+        XX(OP_THREAD_ID);
+        XX(OP_NEWLINE);
+        XX(OP_DATETIME);
+        XX(OP_FILENAME);
+        XX(OP_LINE);
+        XX(OP_TAB);
+        XX(OP_FIBER_ID);
+        XX(OP_THREAD_NAME);
+        XX(OP_FIELDS);
+#undef XX
+        }
     }
-    m_filestream.open(m_filename);
-    return !!m_filestream;
 }
- 
-void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        std::cout << m_formatter->format(logger, level, event);
+
+void LogFormatter::addOp(OpCode code, const std::string& arg) {
+    if (code == OP_LITERAL && !m_ops.empty()
+            && m_ops.back().code == OP_LITERAL
+            && m_ops.back().offset + m_ops.back().length == m_literals.size()) {
+        m_ops.back().length += arg.size();
+    } else {
+        m_ops.push_back(Op{code, (uint32_t)m_literals.size(), (uint32_t)arg.size()});
     }
+    m_literals.append(arg);
 }
 
-LogFormatter::LogFormatter(const std::string& pattern) 
-    :m_pattern(pattern) {
+JsonLogFormatter::JsonLogFormatter(const std::string& time_format)
+    :LogFormatter("")
+    ,m_timeFormat(time_format) {
 }
 
-std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for (auto& i : m_item) {
-        i->format(ss, logger, level, event);
+void JsonLogFormatter::format(LogBuffer& buf, const Logger& logger, LogLevel::Level level, const LogEvent& event) const {
+#define XX(key) \
+    buf.append(key, sizeof(key) - 1)
+
+    XX("{\"time\":\"");
+    FormatTime(buf, m_timeFormat.data(), m_timeFormat.size(), event.getTimeUS());
+    XX("\",\"level\":\"");
+    buf.append(LogLevel::ToString(level));
+    XX("\",\"logger\":");
+    AppendString(buf, logger.getName().data(), logger.getName().size());
+    XX(",\"thread\":");
+    AppendThreadId(buf, event.getThreadId());
+    XX(",\"thread_name\":");
+    AppendString(buf, event.getThreadName().data(), event.getThreadName().size());
+    XX(",\"fiber\":");
+    buf.appendUInt(event.getFiberId());
+    XX(",\"file\":");
+    AppendString(buf, event.getFile(), strlen(event.getFile()));
+    XX(",\"line\":");
+    buf.appendInt(event.getLine());
+    XX(",\"msg\":");
+    std::string_view content = event.getContentView();
+    AppendString(buf, content.data(), content.size());
+#undef XX
+
+    const LogFields& fields = event.getFields();
+    for (size_t i = 0; i < fields.size(); ++ i) {
+        const LogFields::Field& f = fields[i];
+        std::string_view key = fields.key(f);
+        buf.append(',');
+        AppendString(buf, key.data(), key.size());
+        buf.append(':');
+        switch (f.type) {
+            case LogFields::INT:
+                buf.appendInt(f.i);
+                break;
+            case LogFields::UINT:
+                buf.appendUInt(f.u);
+                break;
+            case LogFields::DOUBLE:
+                // JSON has no inf/nan
+                if (std::isfinite(f.d)) {
+                    buf.appendDouble(f.d);
+                } else {
+                    buf.append("null", 4);
+                }
+                break;
+            case LogFields::BOOL:
+                buf.append(f.b ? "true" : "false");
+                break;
+            case LogFields::STRING: {
+                std::string_view v = fields.str(f);
+                AppendString(buf, v.data(), v.size());
+                break;
+            }
+        }
     }
-    return ss.str();
+    buf.append("}\n", 2);
+}
+
+void JsonLogFormatter::AppendString(LogBuffer& buf, const char* str, size_t len) {
+    buf.append('"');
+    AppendEscaped(buf, str, len, ESCAPE_JSON);
+    buf.append('"');
 }
 
 // %xxx %xxx{xxx} %%
 void LogFormatter::init() {
-    // str, format, type
-    std::vector<std::tuple<std::string, std::string, int> > vec;
+    static const std::map<std::string, OpCode> s_ops = {
+#define XX(str, C) \
+        {#str, C}
+
+        XX(m, OP_MESSAGE),
+        XX(p, OP_LEVEL),
+        XX(r, OP_ELAPSE),
+        XX(c, OP_NAME),
+        XX(t, OP_THREAD_ID),
+        XX(n, OP_NEWLINE),
+        XX(d, OP_DATETIME),
+        XX(f, OP_FILENAME),
+        XX(l, OP_LINE),
+        XX(T, OP_TAB),
+        XX(F, OP_FIBER_ID),
+        XX(N, OP_THREAD_NAME),
+        XX(K, OP_FIELDS),
+#undef XX
+    };
+
+    m_ops.clear();
+    m_literals.clear();
+    m_error = false;
     std::string nstr;
-    size_t last_pos = 0;
     for (size_t i = 0; i < m_pattern.size(); ++ i) {
         if (m_pattern[i] != '%') {
             nstr.append(1, m_pattern[i]);
@@ -213,6 +2988,7 @@ void LogFormatter::init() {
         if ((i + 1) < m_pattern.size()) {
             if (m_pattern[i + 1] == '%') {
                 nstr.append(1, m_pattern[i]);
+                ++ i;
                 continue;
             }
         }
@@ -223,7 +2999,7 @@ void LogFormatter::init() {
         std::string str;
         std::string fmt;
         while (n < m_pattern.size()) {
-            if (isspace(m_pattern[n])) {
+            if (fmt_status == 0 && !isalpha(m_pattern[n]) && m_pattern[n] != '{') {
                break;
             }
             if (fmt_status == 0) {
@@ -240,59 +3016,622 @@ void LogFormatter::init() {
                     fmt = m_pattern.substr(fmt_begin + 1, n - fmt_begin - 1);
                     fmt_status = 2;
                     ++ n;
-                    continue;
+                    break;
+                }
+            }
+            ++ n;
         }
 
-        if (fmt_status == 0) {
-            if (!nstr.empty()) {
-                vec.push_back(std::make_tuple(nstr, std::string(), 0));
-            }
-            str = m_pattern.substr(i + 1, n - i - 1);
-            vec.push_back(std::make_tuple(str, fmt, 1));
-            i = n;
-        } else if (fmt_status == 1) {
+        if (!nstr.empty()) {
+            addOp(OP_LITERAL, nstr);
+            nstr.clear();
+        }
+        if (fmt_status == 1) {
             std::cout << "pattern parse error: " << m_pattern << "-" << m_pattern.substr(i) << std::endl;
-            vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
-        } else if (fmt_status == 2) {
-            vec.push_back(std::make_tuple(str, fmt, 1));
-            i = n;
+            m_error = true;
+            addOp(OP_LITERAL, "<<pattern_error>>");
+        } else {
+            if (fmt_status == 0) {
+                str = m_pattern.substr(i + 1, n - i - 1);
+            }
+            auto it = s_ops.find(str);
+            if (it == s_ops.end()) {
+                m_error = true;
+                addOp(OP_LITERAL, "<<error_format %" + str + ">>");
+            } else {
+                addOp(it->second, fmt);
+            }
         }
+        i = n - 1;
     }
     
     if (!nstr.empty()) {
-        vec.push_back(std::make_tuple(nstr, "", 0));
+        addOp(OP_LITERAL, nstr);
     }
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)> > s_format_items = {
-#define XX(str, C) \
-        {#str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt));}} 
-
-        XX(m, MessageFormatItem), 
-        XX(p, LevelFormatItem), 
-        XX(r, ElapseFormatItem), 
-        XX(c, NameFormatItem),
-        XX(t, ThreadIdFormatItem),
-        XX(n, NewLineFormatItem), 
-        XX(d, DataTimeFormatItem),
-        XX(f, FilenameFormatItem),
-        XX(l, LineFormatItem), 
-#undef XX
-    };
+}
     
-    for (auto& i : vec) {
-        if (std::get<2>(i) == 0) {
-            m_item.push_back(FormatItem::ptr(new StringFormatItem(get<0>(i))));
-        } else {
-            auto it = s_format_items.find(std::get<0>(i));
-            if (it == s_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-            } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+constexpr char BinaryLogWriter::MAGIC[8];
+
+static std::atomic<uint64_t> s_binary_id{0};
+
+BinaryLogWriter::BinaryLogWriter(const std::string& filename, size_t buffer_size)
+    :m_filename(filename)
+    ,m_bufferSize(buffer_size)
+    ,m_buffer(buffer_size + 4096)
+    ,m_id(++ s_binary_id) {
+    reopen();
+    LogCrashHandler::Register(this, LogCrashFlushable::BUFFER);
+}
+
+BinaryLogWriter::~BinaryLogWriter() {
+    LogCrashHandler::Unregister(this);
+    {
+        std::lock_guard<std::mutex> lock(m_stagesMutex);
+        for (auto& i : m_stages) {
+            std::lock_guard<std::mutex> stage_lock(i->mutex);
+            handoff(*i, false);
+            i->writer.store(nullptr);
+        }
+        m_stages.clear();
+    }
+    flush();
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool BinaryLogWriter::reopen() {
+    // producers hold their stage lock while they check m_fd and the definitions
+    std::lock_guard<std::mutex> lock(m_stagesMutex);
+    std::vector<std::unique_lock<std::mutex>> stage_locks;
+    for (auto& i : m_stages) {
+        stage_locks.emplace_back(i->mutex);
+    }
+    std::lock_guard<std::mutex> buffer_lock(m_mutex);
+    for (auto& i : m_stages) {
+        m_buffer.append(i->buffer.data(), i->buffer.size());
+        i->buffer.clear();
+        i->sites.clear();
+        i->loggers.clear();
+        i->threadDefined = false;
+    }
+    writeBuffer();
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && st.st_size == 0) {
+        m_buffer.append(MAGIC, sizeof(MAGIC));
+    }
+    return true;
+}
+
+void BinaryLogWriter::flush() {
+    std::lock_guard<std::mutex> lock(m_stagesMutex);
+    drainStages();
+}
+
+void BinaryLogWriter::drainStages() {
+    for (auto& i : m_stages) {
+        std::lock_guard<std::mutex> lock(i->mutex);
+        handoff(*i, false);
+    }
+    m_stages.erase(std::remove_if(m_stages.begin(), m_stages.end()
+                , [](const Stage::ptr& stage) {
+                    std::lock_guard<std::mutex> lock(stage->mutex);
+                    return stage->closed;
+                })
+            , m_stages.end());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    writeBuffer();
+}
+
+void BinaryLogWriter::crashFlush(uint64_t deadline, const char* record, size_t len) {
+    if (LogCrashHandler::TryLock(m_stagesMutex, deadline)) {
+        for (auto& i : m_stages) {
+            // the crashed thread may hold its own stage, do not spend the deadline on it
+            uint64_t stage_deadline = std::min<uint64_t>(deadline, LogCrashHandler::Now() + 10000000ull);
+            if (LogCrashHandler::TryLock(i->mutex, stage_deadline)) {
+                if (LogCrashHandler::TryLock(m_mutex, deadline)) {
+                    m_buffer.append(i->buffer.data(), i->buffer.size());
+                    i->buffer.clear();
+                    m_mutex.unlock();
+                }
+                i->mutex.unlock();
             }
         }
-        std::cout << std::get<0>(i) << " - " << std::get<1>(i) << " - " << std::get<2>(i) << std::endl;
+        m_stagesMutex.unlock();
+    }
+    if (LogCrashHandler::TryLock(m_mutex, deadline)) {
+        writeBuffer();
+        m_mutex.unlock();
     }
-    
 }
-    
+
+void BinaryLogWriter::writeBuffer() {
+    const char* data = m_buffer.data();
+    size_t left = m_buffer.size();
+    while (left && m_fd >= 0) {
+        ssize_t n = ::write(m_fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+    m_buffer.clear();
+}
+
+void BinaryLogWriter::AppendRecord(LogBuffer& buf, RecordType type, const char* data, size_t len) {
+    uint32_t size = len + 1;
+    buf.append((const char*)&size, sizeof(size));
+    buf.append((char)type);
+    buf.append(data, len);
+}
+
+void BinaryLogWriter::handoff(Stage& stage, bool write) {
+    if (stage.buffer.size() == 0 && !write) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.append(stage.buffer.data(), stage.buffer.size());
+    stage.buffer.clear();
+    if (write || m_buffer.size() >= m_bufferSize) {
+        writeBuffer();
+    }
+}
+
+BinaryLogWriter::Stage* BinaryLogWriter::getStage() {
+    // trivially destructible, still valid after t_holder is gone
+    static thread_local Stage* t_last = nullptr;
+    static thread_local bool t_exited = false;
+    struct Holder {
+        std::vector<Stage::ptr> stages;
+
+        ~Holder() {
+            for (auto& i : stages) {
+                std::lock_guard<std::mutex> lock(i->mutex);
+                if (BinaryLogWriter* writer = i->writer.load()) {
+                    writer->handoff(*i, false);
+                }
+                i->closed = true;
+            }
+            t_last = nullptr;
+            t_exited = true;
+        }
+    };
+    static thread_local Holder t_holder;
+    if (t_exited) {
+        return nullptr;
+    }
+    if (t_last && t_last->owner == m_id) {
+        return t_last;
+    }
+    for (auto& i : t_holder.stages) {
+        if (i->owner == m_id) {
+            return t_last = i.get();
+        }
+    }
+    // stages of destroyed writers
+    t_last = nullptr;
+    t_holder.stages.erase(std::remove_if(t_holder.stages.begin(), t_holder.stages.end()
+                , [](const Stage::ptr& stage) { return !stage->writer.load(); })
+            , t_holder.stages.end());
+    Stage::ptr stage = std::make_shared<Stage>();
+    stage->owner = m_id;
+    stage->writer.store(this);
+    {
+        std::lock_guard<std::mutex> lock(m_stagesMutex);
+        m_stages.push_back(stage);
+    }
+    t_holder.stages.push_back(stage);
+    return t_last = stage.get();
+}
+
+void BinaryLogWriter::StageRecord(Stage& stage, const Logger& logger, const LogCallSite& site
+        , const std::string& thread_name, uint32_t thread_id, const LogBuffer& record) {
+    uint32_t site_id = site.getId();
+    if (site_id >= stage.sites.size() || !stage.sites[site_id]) {
+        if (site_id >= stage.sites.size()) {
+            stage.sites.resize(site_id + 1);
+        }
+        stage.sites[site_id] = true;
+        LogBuffer def;
+        int8_t level = site.info.level;
+        uint32_t file_len = strlen(site.info.file);
+        def.append((const char*)&site_id, sizeof(site_id));
+        def.append((const char*)&level, sizeof(level));
+        def.append((const char*)&site.info.line, sizeof(site.info.line));
+        def.append((const char*)&file_len, sizeof(file_len));
+        def.append(site.info.file, file_len);
+        def.append(site.info.fmt);
+        AppendRecord(stage.buffer, site.info.brace ? RECORD_BRACE_SITE : RECORD_SITE
+                , def.data(), def.size());
+    }
+    uint32_t logger_id = logger.getId();
+    if (logger_id >= stage.loggers.size() || !stage.loggers[logger_id]) {
+        if (logger_id >= stage.loggers.size()) {
+            stage.loggers.resize(logger_id + 1);
+        }
+        stage.loggers[logger_id] = true;
+        LogBuffer def;
+        def.append((const char*)&logger_id, sizeof(logger_id));
+        def.append(logger.getName());
+        AppendRecord(stage.buffer, RECORD_LOGGER, def.data(), def.size());
+    }
+    if (!stage.threadDefined || stage.threadName != thread_name) {
+        stage.threadDefined = true;
+        stage.threadName = thread_name;
+        LogBuffer def;
+        def.append((const char*)&thread_id, sizeof(thread_id));
+        def.append(thread_name);
+        AppendRecord(stage.buffer, RECORD_THREAD, def.data(), def.size());
+    }
+    AppendRecord(stage.buffer, RECORD_EVENT, record.data(), record.size());
+}
+
+void BinaryLogWriter::commit(const Logger& logger, const LogCallSite& site
+        , const std::string& thread_name, uint32_t thread_id, const LogBuffer& record) {
+    bool fatal = site.info.level >= LogLevel::FATAL;
+    Stage* stage = getStage();
+    if (!stage) {
+        // thread_local destructors: carry every definition with the record
+        Stage local;
+        StageRecord(local, logger, site, thread_name, thread_id, record);
+        std::lock_guard<std::mutex> lock(local.mutex);
+        handoff(local, fatal);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stage->mutex);
+    if (m_fd < 0) {
+        return;
+    }
+    StageRecord(*stage, logger, site, thread_name, thread_id, record);
+    if (fatal || stage->buffer.size() >= STAGE_SIZE) {
+        handoff(*stage, fatal);
+    }
+}
+
+BinaryLogReader::BinaryLogReader(const std::string& filename)
+    :m_in(filename, std::ios::binary) {
+    char magic[sizeof(BinaryLogWriter::MAGIC)];
+    m_valid = m_in.read(magic, sizeof(magic))
+        && memcmp(magic, BinaryLogWriter::MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * @brief 按顺序读取记录中的定长字段
+ */
+template<class T>
+static bool ReadField(const char*& p, const char* end, T& v) {
+    if (end - p < (ptrdiff_t)sizeof(T)) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+bool BinaryLogReader::next(LogEvent::ptr& event) {
+    while (m_valid) {
+        uint32_t size = 0;
+        if (!m_in.read((char*)&size, sizeof(size)) || size == 0) {
+            return false;
+        }
+        m_record.resize(size);
+        if (!m_in.read(&m_record[0], size)) {
+            return false;
+        }
+        const char* p = m_record.data() + 1;
+        const char* end = m_record.data() + size;
+        uint32_t id = 0;
+        if (!ReadField(p, end, id)) {
+            return false;
+        }
+        switch ((uint8_t)m_record[0]) {
+            case BinaryLogWriter::RECORD_SITE:
+            case BinaryLogWriter::RECORD_BRACE_SITE: {
+                int8_t level = 0;
+                uint32_t file_len = 0;
+                Site& site = m_sites[id];
+                if (!ReadField(p, end, level) || !ReadField(p, end, site.line)
+                        || !ReadField(p, end, file_len) || file_len > (size_t)(end - p)) {
+                    return false;
+                }
+                site.level = (LogLevel::Level)level;
+                site.file.assign(p, file_len);
+                site.fmt.assign(p + file_len, end);
+                site.brace = (uint8_t)m_record[0] == BinaryLogWriter::RECORD_BRACE_SITE;
+                break;
+            }
+            case BinaryLogWriter::RECORD_LOGGER:
+                m_loggers[id].reset(new Logger(std::string(p, end)));
+                break;
+            case BinaryLogWriter::RECORD_THREAD:
+                m_threads[id].assign(p, end);
+                break;
+            case BinaryLogWriter::RECORD_EVENT: {
+                uint32_t logger_id = 0;
+                uint64_t time = 0;
+                uint32_t thread_id = 0;
+                uint32_t fiber_id = 0;
+                if (!ReadField(p, end, logger_id) || !ReadField(p, end, time)
+                        || !ReadField(p, end, thread_id) || !ReadField(p, end, fiber_id)) {
+                    return false;
+                }
+                auto sit = m_sites.find(id);
+                if (sit == m_sites.end()) {
+                    continue;
+                }
+                auto& logger = m_loggers[logger_id];
+                if (!logger) {
+                    logger.reset(new Logger("unknown"));
+                }
+                const Site& site = sit->second;
+                event.reset(new LogEvent(logger, site.level, site.file.c_str(), site.line
+                            , 0, thread_id, fiber_id, std::chrono::microseconds(time)
+                            , m_threads[thread_id]));
+                FormatArgs(event->getSS(), site.fmt.c_str(), site.brace, p, end - p);
+                return true;
+            }
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+/**
+ * @brief 依次读取编码后的参数
+ */
+struct BinaryArgs {
+    const char* p;
+    const char* end;
+
+    /**
+     * @brief 读取下一个参数
+     * @return 参数类型, 没有更多参数返回0
+     */
+    uint8_t next(int64_t& i, uint64_t& u, double& d, std::string& s) {
+        uint8_t type = 0;
+        if (!ReadField(p, end, type)) {
+            return 0;
+        }
+        switch (type) {
+            case BinaryLogWriter::ARG_INT:
+                if (ReadField(p, end, i)) {
+                    u = i;
+                    d = i;
+                    return type;
+                }
+                break;
+            case BinaryLogWriter::ARG_UINT:
+            case BinaryLogWriter::ARG_POINTER:
+                if (ReadField(p, end, u)) {
+                    i = u;
+                    d = u;
+                    return type;
+                }
+                break;
+            case BinaryLogWriter::ARG_DOUBLE:
+                if (ReadField(p, end, d)) {
+                    i = d;
+                    u = d;
+                    return type;
+                }
+                break;
+            case BinaryLogWriter::ARG_STRING: {
+                uint32_t len = 0;
+                if (ReadField(p, end, len) && len <= (size_t)(end - p)) {
+                    s.assign(p, len);
+                    p += len;
+                    i = u = 0;
+                    d = 0;
+                    return type;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        p = end;
+        return 0;
+    }
+};
+
+/**
+ * @brief 按单个转换说明格式化, 输出到os
+ */
+template<class T>
+void FormatSpec(LogStream& os, const std::string& spec, T v) {
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), spec.c_str(), v);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < sizeof(buf)) {
+        os.write(buf, len);
+        return;
+    }
+    std::string str(len + 1, '\0');
+    snprintf(&str[0], str.size(), spec.c_str(), v);
+    os.write(str.data(), len);
+}
+
+}
+
+void BinaryLogReader::FormatArgs(LogStream& os, const char* fmt, bool brace
+        , const char* args, size_t len) {
+    BinaryArgs reader{args, args + len};
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    std::string s;
+    if (brace) {
+        int count = LogBraceFormat::Compile(fmt, nullptr);
+        if (count < 0) {
+            os << fmt;
+            return;
+        }
+        std::vector<LogBraceFormat::Op> ops(count);
+        LogBraceFormat::Compile(fmt, ops.data());
+        for (auto& op : ops) {
+            if (op.arg < 0) {
+                os.write(fmt + op.offset, op.length);
+                continue;
+            }
+            switch (reader.next(i, u, d, s)) {
+                case BinaryLogWriter::ARG_INT:
+                    LogFormatArg(os, i);
+                    break;
+                case BinaryLogWriter::ARG_UINT:
+                    LogFormatArg(os, u);
+                    break;
+                case BinaryLogWriter::ARG_POINTER:
+                    LogFormatArg(os, (const void*)(uintptr_t)u);
+                    break;
+                case BinaryLogWriter::ARG_DOUBLE:
+                    LogFormatArg(os, d);
+                    break;
+                case BinaryLogWriter::ARG_STRING:
+                    LogFormatArg(os, s);
+                    break;
+                default:
+                    os << "<?>";
+                    break;
+            }
+        }
+        return;
+    }
+    // the writer puts errno ahead of the arguments for %m
+    int err = 0;
+    if (LogPrintfUsesErrno(fmt)) {
+        reader.next(i, u, d, s);
+        err = (int)i;
+    }
+    const char* f = fmt;
+    while (*f) {
+        if (*f != '%') {
+            const char* begin = f;
+            while (*f && *f != '%') {
+                ++ f;
+            }
+            os.write(begin, f - begin);
+            continue;
+        }
+        if (f[1] == '%') {
+            os.put('%');
+            f += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion, '*' replaced by its argument
+        std::string spec(1, '%');
+        ++ f;
+        while (*f && strchr("-+ #0'", *f)) {
+            spec.append(1, *f ++);
+        }
+        for (int part = 0; part < 2; ++ part) {
+            if (part == 1) {
+                if (*f != '.') {
+                    break;
+                }
+                spec.append(1, *f ++);
+            }
+            if (*f == '*') {
+                reader.next(i, u, d, s);
+                spec.append(std::to_string((int)i));
+                ++ f;
+            }
+            while (*f >= '0' && *f <= '9') {
+                spec.append(1, *f ++);
+            }
+        }
+        std::string length;
+        while (*f && strchr("hlLqjzt", *f)) {
+            length.append(1, *f ++);
+        }
+        char conv = *f;
+        if (!conv) {
+            break;
+        }
+        ++ f;
+        if (conv == 'm') {
+            FormatSpec(os, spec + 's', strerror(err));
+            continue;
+        }
+        uint8_t type = reader.next(i, u, d, s);
+        if (!type) {
+            os << "<?>";
+            continue;
+        }
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (length == "hh") {
+                    i = (signed char)i;
+                } else if (length == "h") {
+                    i = (short)i;
+                } else if (length.empty()) {
+                    i = (int)i;
+                } else if (length == "l") {
+                    i = (long)i;
+                }
+                FormatSpec(os, spec + "ll" + conv, (long long)i);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                if (length == "hh") {
+                    u = (unsigned char)u;
+                } else if (length == "h") {
+                    u = (unsigned short)u;
+                } else if (length.empty()) {
+                    u = (unsigned int)u;
+                } else if (length == "l") {
+                    u = (unsigned long)u;
+                }
+                FormatSpec(os, spec + "ll" + conv, (unsigned long long)u);
+                break;
+            case 'c':
+                FormatSpec(os, spec + conv, (int)i);
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                FormatSpec(os, spec + conv, d);
+                break;
+            case 's':
+                if (type == BinaryLogWriter::ARG_STRING) {
+                    FormatSpec(os, spec + conv, s.c_str());
+                } else {
+                    os << "<?>";
+                }
+                break;
+            case 'p':
+                FormatSpec(os, spec + conv, (void*)(uintptr_t)u);
+                break;
+            case 'n':
+                break;
+            default:
+                os << spec << length << conv;
+                break;
+        }
+    }
+}
+
 }
-    
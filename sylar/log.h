@@ -6,90 +6,805 @@
 #include <stdint.h>
 #include <memory>
 #include <list>
+#include <map>
 #include <sstream>
 #include <fstream>
 #include <vector>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+#include <functional>
+#include <chrono>
+#include <charconv>
+#include <sys/uio.h>
+#include "singleton.h"
+#include "util.h"
+#include "thread.h"
  
+/**
+ * @brief 编译期日志级别, 低于该级别的固定级别日志语句不生成任何代码(参数仍做类型检查)
+ * @details 可以是数值或级别名, 例如 -DSYLAR_LOG_ACTIVE_LEVEL=sylar::LogLevel::INFO,
+ *          默认不剔除任何级别. 语句所在的函数是模板时, 被剔除的参数不实例化.
+ *          作用于SYLAR_LOG_DEBUG/INFO/...这类固定级别的宏和SYLAR_LOG_CONST_LEVEL,
+ *          SYLAR_LOG_LEVEL(logger, level)的级别在运行期判断, 不剔除
+ */
+#ifndef SYLAR_LOG_ACTIVE_LEVEL
+#define SYLAR_LOG_ACTIVE_LEVEL 0
+#endif
+
+/**
+ * @brief 日志级别level是否编译进程序
+ */
+#define SYLAR_LOG_LEVEL_ACTIVE(level) ((int)(level) >= (int)(SYLAR_LOG_ACTIVE_LEVEL))
+
+/**
+ * @brief 流式日志的实现, site_level为记录在调用点中的级别
+ */
+#define SYLAR_LOG_SITE_LEVEL(logger, site_level, level) \
+	if (static sylar::LogCallSite _sylar_site({__FILE__, __LINE__, __func__, site_level, nullptr}); \
+			_sylar_site.isEnabled(logger->getLevel(), level)) \
+		sylar::LogEventWrap(sylar::LogEventPool::Acquire(logger, _sylar_site, level, \
+			0, sylar::GetThreadId(), sylar::GetFiberId(), sylar::GetLogTimeUS(), \
+			sylar::Thread::GetName())).getSS()
+
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
+ * @details level在运行期判断, 可以是变量
  */
  
 #define SYLAR_LOG_LEVEL(logger, level) \
-	if (logger->getLevel() <= level) \
-		sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
-			__FILE__, __LINE__, 0, sylar::GetThreadId(), \
-		sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getSS()
+	SYLAR_LOG_SITE_LEVEL(logger, sylar::LogLevel::UNKNOW, level)
+
+/**
+ * @brief 使用流式方式将常量级别level的日志写入到logger
+ * @details level须为常量表达式, 低于SYLAR_LOG_ACTIVE_LEVEL时不生成代码
+ */
+#define SYLAR_LOG_CONST_LEVEL(logger, level) \
+	if constexpr (!SYLAR_LOG_LEVEL_ACTIVE(level)) {} else \
+	SYLAR_LOG_SITE_LEVEL(logger, level, level)
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
  */
-#define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
+#define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_CONST_LEVEL(logger, sylar::LogLevel::DEBUG)
 
 /**
  * @brief 使用流式方式将日志级别info的日志写入到logger
  */
-#define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
+#define SYLAR_LOG_INFO(logger) SYLAR_LOG_CONST_LEVEL(logger, sylar::LogLevel::INFO)
 
 /**
  * @brief 使用流式方式将日志级别warn的日志写入到logger
  */
-#define SYLAR_LOG_WARN(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::WARN)
+#define SYLAR_LOG_WARN(logger) SYLAR_LOG_CONST_LEVEL(logger, sylar::LogLevel::WARN)
 
 /**
  * @brief 使用流式方式将日志级别error的日志写入到logger
  */
-#define SYLAR_LOG_ERROR(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::ERROR)
+#define SYLAR_LOG_ERROR(logger) SYLAR_LOG_CONST_LEVEL(logger, sylar::LogLevel::ERROR)
 
 /**
  * @brief 使用流式方式将日志级别fatal的日志写入到logger
  */
-#define SYLAR_LOG_FATAL(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::FATAL)
+#define SYLAR_LOG_FATAL(logger) SYLAR_LOG_CONST_LEVEL(logger, sylar::LogLevel::FATAL)
+
 
+/**
+ * @brief 格式化日志的实现, site_level为记录在调用点中的级别
+ * @details 只有字符串字面量的格式串保存在调用点中, 可以写二进制记录
+ */
+#define SYLAR_LOG_FMT_SITE_LEVEL(logger, site_level, level, fmt, ...) \
+	if (static sylar::LogCallSite _sylar_site({__FILE__, __LINE__, __func__, site_level, \
+				sylar::LogIsLiteral<decltype(fmt)>::value ? fmt : nullptr}); \
+			_sylar_site.isEnabled(logger->getLevel(), level)) \
+		sylar::LogFmt<sylar::LogIsLiteral<decltype(fmt)>::value && sylar::LogPrintfUsesErrno(fmt)>( \
+			logger, _sylar_site, level, fmt, sylar::GetThreadId(), \
+			sylar::GetFiberId(), sylar::Thread::GetName(), __VA_ARGS__)
 
 /**
- * @brief 使用格式化方式将日志级别level的日志写入到logger
+ * @brief 使用printf格式将日志级别level的日志写入到logger
+ * @details fmt可以是任意const char*, 不解释"{}".
+ *          level在运行期判断, 可以是变量, 这类调用点总是生成日志事件
  */
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-	if (logger->getLevel() <= level) \
-		sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
-			__FILE__, __LINE__, 0, sylar::GetThreadId(), \
-		sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+	SYLAR_LOG_FMT_SITE_LEVEL(logger, sylar::LogLevel::UNKNOW, level, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用printf格式将常量级别level的日志写入到logger
+ * @details level须为常量表达式, 低于SYLAR_LOG_ACTIVE_LEVEL时不生成代码.
+ *          fmt为字符串字面量且logger设置了BinaryLogWriter时只写入调用点id, 时间和原始参数,
+ *          由sylar-logdecode离线格式化
+ */
+#define SYLAR_LOG_FMT_CONST_LEVEL(logger, level, fmt, ...) \
+	if constexpr (!SYLAR_LOG_LEVEL_ACTIVE(level)) {} else \
+	SYLAR_LOG_FMT_SITE_LEVEL(logger, level, level, fmt, __VA_ARGS__)
  
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
  */
-#define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...)  SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...)  SYLAR_LOG_FMT_CONST_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别info的日志写入到logger
  */
-#define SYLAR_LOG_FMT_INFO(logger, fmt, ...)  SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_INFO(logger, fmt, ...)  SYLAR_LOG_FMT_CONST_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别warn的日志写入到logger
  */
-#define SYLAR_LOG_FMT_WARN(logger, fmt, ...)  SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::WARN, fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_WARN(logger, fmt, ...)  SYLAR_LOG_FMT_CONST_LEVEL(logger, sylar::LogLevel::WARN, fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别warn的日志写入到logger
  */
-#define SYLAR_LOG_FMT_ERROR(logger, fmt, ...)  SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_ERROR(logger, fmt, ...)  SYLAR_LOG_FMT_CONST_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
  
 /**
  * @brief 使用格式化方式将日志级别fatal的日志写入到logger
  */
-#define SYLAR_LOG_FMT_FATAL(logger, fmt, ...)  SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_FATAL(logger, fmt, ...)  SYLAR_LOG_FMT_CONST_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
+
+/**
+ * @brief {}格式日志的实现, site_level为记录在调用点中的级别
+ */
+#define SYLAR_LOG_BRACE_SITE_LEVEL(logger, site_level, level, fmt, ...) \
+	if (static sylar::LogCallSite _sylar_site({__FILE__, __LINE__, __func__, site_level, fmt, true}); \
+			_sylar_site.isEnabled(logger->getLevel(), level)) \
+		sylar::LogBraceFmt(logger, _sylar_site, level, [] { return fmt; }, sylar::GetThreadId(), \
+			sylar::GetFiberId(), sylar::Thread::GetName(), __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别level的日志写入到logger
+ * @details fmt须为字符串字面量, 在编译期检查和解析(见LogBraceFormat).
+ *          level在运行期判断, 可以是变量, 这类调用点总是生成日志事件
+ */
+#define SYLAR_LOG_BRACE_LEVEL(logger, level, fmt, ...) \
+	SYLAR_LOG_BRACE_SITE_LEVEL(logger, sylar::LogLevel::UNKNOW, level, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将常量级别level的日志写入到logger
+ * @details level须为常量表达式, 低于SYLAR_LOG_ACTIVE_LEVEL时不生成代码.
+ *          logger设置了BinaryLogWriter且参数都能编码时只写入调用点id, 时间和原始参数
+ */
+#define SYLAR_LOG_BRACE_CONST_LEVEL(logger, level, fmt, ...) \
+	if constexpr (!SYLAR_LOG_LEVEL_ACTIVE(level)) {} else \
+	SYLAR_LOG_BRACE_SITE_LEVEL(logger, level, level, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别debug的日志写入到logger
+ */
+#define SYLAR_LOG_BRACE_DEBUG(logger, fmt, ...)  SYLAR_LOG_BRACE_CONST_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别info的日志写入到logger
+ */
+#define SYLAR_LOG_BRACE_INFO(logger, fmt, ...)  SYLAR_LOG_BRACE_CONST_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别warn的日志写入到logger
+ */
+#define SYLAR_LOG_BRACE_WARN(logger, fmt, ...)  SYLAR_LOG_BRACE_CONST_LEVEL(logger, sylar::LogLevel::WARN, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别error的日志写入到logger
+ */
+#define SYLAR_LOG_BRACE_ERROR(logger, fmt, ...)  SYLAR_LOG_BRACE_CONST_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用{}格式将日志级别fatal的日志写入到logger
+ */
+#define SYLAR_LOG_BRACE_FATAL(logger, fmt, ...)  SYLAR_LOG_BRACE_CONST_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
+
+/**
+ * @brief 使用流式方式写入受调用点限流/采样策略限制的日志
+ * @details 被拒绝的日志在构造LogEvent之前返回, 见LogLimitedSite
+ */
+#define SYLAR_LOG_LIMITED(logger, level, policy, n) \
+	if constexpr (!SYLAR_LOG_LEVEL_ACTIVE(level)) {} else \
+	if (static sylar::LogLimitedSite _sylar_site({__FILE__, __LINE__, __func__, level, nullptr}, policy, n); \
+			_sylar_site.admit(logger->getLevel(), level, logger)) \
+		sylar::LogEventWrap(sylar::LogEventPool::Acquire(logger, _sylar_site, level, \
+			0, sylar::GetThreadId(), sylar::GetFiberId(), sylar::GetLogTimeUS(), \
+			sylar::Thread::GetName())).getSS()
+
+/**
+ * @brief 该调用点第1, n+1, 2n+1...次执行时写入日志
+ */
+#define SYLAR_LOG_EVERY_N(logger, level, n) SYLAR_LOG_LIMITED(logger, level, sylar::LogLimitedSite::EVERY_N, n)
+
+/**
+ * @brief 该调用点只有前n次执行写入日志
+ */
+#define SYLAR_LOG_FIRST_N(logger, level, n) SYLAR_LOG_LIMITED(logger, level, sylar::LogLimitedSite::FIRST_N, n)
+
+/**
+ * @brief 该调用点每秒最多写入per_sec条日志(允许1秒的突发), 恢复时先写一条被抑制条数的汇总
+ */
+#define SYLAR_LOG_RATE_LIMITED(logger, level, per_sec) SYLAR_LOG_LIMITED(logger, level, sylar::LogLimitedSite::RATE_LIMITED, per_sec)
  
+/**
+ * @brief 创建模板在编译期解析的日志格式器
+ * @details 模板有错误时编译失败, 例如 SYLAR_STATIC_LOG_FORMATTER("%d%T%m%n")
+ */
+#define SYLAR_STATIC_LOG_FORMATTER(pattern) \
+    ([]() { \
+        static constexpr char s_pattern[] = pattern; \
+        return sylar::LogFormatter::ptr(new sylar::StaticLogFormatter<s_pattern>()); \
+    }())
+
 /**
  * @brief 获取主日志器
  */
  #define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstance()->getRoot()
 
+/**
+ * @brief 获取name的日志器, 每个调用点只查找一次并缓存在静态变量中
+ * @details name在同一调用点应当不变, 例如 SYLAR_LOG_INFO(SYLAR_LOG_NAME("net.http")) << "msg";
+ */
+#define SYLAR_LOG_NAME(name) \
+    ([&]() -> const sylar::Logger::ptr& { \
+        static const sylar::Logger::ptr s_logger = sylar::LoggerMgr::GetInstance()->getLogger(name); \
+        return s_logger; \
+    }())
+
 namespace sylar {
 
 class Logger;
-class LoggerManger;
+class LoggerManager;
+class BinaryLogWriter;
+
+/**
+ * @brief 返回日志时间戳(微秒)
+ * @details 使用CLOCK_REALTIME_COARSE, 走vDSO不陷入内核, 精度为一个时钟节拍(通常1-4ms)
+ */
+inline uint64_t GetLogTimeUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 日志级别 
+ */
+
+class LogLevel {
+public:
+    enum Level {
+	// 未知级别
+        UNKNOW = 0,
+	// DEBUG 级别
+        DEBUG = 1,
+	// INFO 级别
+        INFO = 2,
+	// WARN 级别
+        WARN = 3,
+	// ERROR 级别
+        ERROR = 4,
+	// FATAL 级别
+        FATAL = 5
+    };
+     
+	/**
+ 	* @brief 将日志级别转换成文本输出 
+ 	*/
+    	static const char* ToString(LogLevel::Level);
+					
+	/**
+ 	* @brief 将文本输出转换成日志级别
+ 	*/
+	static LogLevel::Level FronmString(const std::string& str);
+};
+ 
+/**
+ * @brief 日志调用点的编译期描述
+ */
+struct LogSiteInfo {
+    /// 文件名
+    const char* file;
+    /// 行号
+    int32_t line;
+    /// 函数名
+    const char* func;
+    /// 日志级别, 只用于描述调用点(如二进制日志的定义记录), 日志事件的级别取自每次调用的参数.
+    /// 级别在运行期给出的调用点(SYLAR_LOG_LEVEL)为UNKNOW
+    LogLevel::Level level;
+    /// 格式字符串, 流式日志和非字面量的printf格式串为nullptr
+    const char* fmt;
+    /// fmt是否为{}格式
+    bool brace;
+};
+
+/**
+ * @brief 日志调用点
+ * @details 每个SYLAR_LOG_*宏展开定义一个常量初始化的静态实例(没有运行期构造和guard),
+ *          第一次执行时注册到全局表, 得到进程内唯一的id并应用已设置的规则, 日志事件只保存
+ *          调用点指针. 每个调用点有一个原子开关, 可以在运行期单独打开(不受日志器级别限制)
+ *          或关闭, 见Control()
+ */
+class LogCallSite {
+public:
+    /**
+     * @brief 调用点开关
+     */
+    enum Mode : int8_t {
+        /// 按日志器级别过滤
+        DEFAULT = 0,
+        /// 总是输出
+        ON = 1,
+        /// 总是不输出
+        OFF = 2,
+        /// 尚未注册
+        UNREGISTERED = 3
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] info 调用点描述
+     */
+    constexpr LogCallSite(const LogSiteInfo& info)
+        :info(info) {
+    }
+
+    LogCallSite(const LogCallSite&) = delete;
+    LogCallSite& operator=(const LogCallSite&) = delete;
+
+    /**
+     * @brief 该调用点本次是否输出
+     * @param[in] logger_level 日志器级别
+     * @param[in] level 本次日志的级别
+     */
+    bool isEnabled(LogLevel::Level logger_level, LogLevel::Level level) {
+        int8_t mode = m_mode.load(std::memory_order_acquire);
+        if (mode == DEFAULT) {
+            return logger_level <= level;
+        }
+        return mode == ON || (mode == UNREGISTERED && registerSite(logger_level, level));
+    }
+
+    /**
+     * @brief 返回开关
+     */
+    Mode getMode() const { return (Mode)m_mode.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 设置开关(未注册时先注册)
+     */
+    void setMode(Mode mode);
+
+    /**
+     * @brief 返回调用点id, 注册后有效
+     */
+    uint32_t getId() const { return m_id; }
+
+    /**
+     * @brief 按id查找调用点, 不存在返回nullptr
+     */
+    static LogCallSite* Get(uint32_t id);
+
+    /**
+     * @brief 按文件和行号设置调用点开关
+     * @details 规则被保存, 之后注册的调用点也按规则设置, 后设置的规则优先
+     * @param[in] file 文件名的通配模式(fnmatch), 与__FILE__匹配, 例如"*net/http*"
+     * @param[in] line 行号, 0表示文件中的所有调用点
+     * @param[in] mode 开关
+     * @return 已注册的调用点中匹配的数量
+     */
+    static size_t Control(const std::string& file, int32_t line, Mode mode);
+
+    /**
+     * @brief 遍历已注册的调用点
+     */
+    static void Visit(std::function<void(LogCallSite&)> cb);
+
+    /// 调用点描述
+    const LogSiteInfo info;
+private:
+    /**
+     * @brief 注册调用点, 返回注册后本次是否输出
+     */
+    bool registerSite(LogLevel::Level logger_level, LogLevel::Level level);
+private:
+    /// 开关
+    std::atomic<int8_t> m_mode{UNREGISTERED};
+    /// 调用点id
+    uint32_t m_id = 0;
+};
+
+/**
+ * @brief 带限流/采样策略的日志调用点
+ * @details 计数和令牌桶都是调用点内的原子变量, 不加锁. 令牌桶按GCRA实现: 只保存下一个令牌的
+ *          理论到达时间, 取令牌是一次CAS. 被限流拒绝的条数累计下来, 下一条放行的日志之前
+ *          写一条"suppressed N messages"的汇总
+ */
+class LogLimitedSite : public LogCallSite {
+public:
+    /**
+     * @brief 策略
+     */
+    enum Policy : uint8_t {
+        /// 每n次写一次
+        EVERY_N = 0,
+        /// 只写前n次
+        FIRST_N = 1,
+        /// 每秒最多n条
+        RATE_LIMITED = 2
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] info 调用点描述
+     * @param[in] policy 策略
+     * @param[in] n 策略参数
+     */
+    constexpr LogLimitedSite(const LogSiteInfo& info, Policy policy, uint64_t n)
+        :LogCallSite(info)
+        ,m_policy(policy)
+        ,m_n(n ? n : 1) {
+    }
+
+    /**
+     * @brief 是否写入这一次日志
+     * @param[in] logger_level 日志器级别
+     * @param[in] level 本次日志的级别
+     * @param[in] logger 日志器, 用于写被抑制条数的汇总
+     */
+    bool admit(LogLevel::Level logger_level, LogLevel::Level level, const std::shared_ptr<Logger>& logger) {
+        if (!isEnabled(logger_level, level)) {
+            return false;
+        }
+        switch (m_policy) {
+            case EVERY_N:
+                return m_state.fetch_add(1, std::memory_order_relaxed) % m_n == 0;
+            case FIRST_N:
+                return m_state.load(std::memory_order_relaxed) < m_n
+                    && m_state.fetch_add(1, std::memory_order_relaxed) < m_n;
+            default:
+                return takeToken(level, logger);
+        }
+    }
+
+    /**
+     * @brief 返回尚未汇总的被抑制条数
+     */
+    uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+private:
+    /**
+     * @brief 从令牌桶取一个令牌, 汇总按level写出
+     */
+    bool takeToken(LogLevel::Level level, const std::shared_ptr<Logger>& logger);
+private:
+    /// 策略
+    Policy m_policy;
+    /// 策略参数
+    uint64_t m_n;
+    /// 执行次数, 或令牌桶的理论到达时间(纳秒)
+    std::atomic<uint64_t> m_state{0};
+    /// 被限流拒绝的条数
+    std::atomic<uint64_t> m_suppressed{0};
+};
+
+class LogBuffer;
+
+/**
+ * @brief 日志使用的线程本地对象
+ * @details 线程退出时对象析构后(在之后运行的thread_local析构函数中写日志), Get返回在own中
+ *          新建的对象, 不会访问已析构的对象. N区分同一类型的不同用途
+ */
+template<class T, int N = 0>
+class LogThreadLocal {
+public:
+    /**
+     * @brief 返回当前线程的对象
+     * @param[in,out] own 线程的对象已析构时持有新建的对象, 生命周期由调用者决定
+     */
+    static T& Get(std::unique_ptr<T>& own) {
+        if (t_dead) {
+            own.reset(new T);
+            return *own;
+        }
+        static thread_local Holder t_holder;
+        return t_holder.value;
+    }
+private:
+    struct Holder {
+        T value;
+        ~Holder() { t_dead = true; }
+    };
+
+    /// 平凡析构, Holder析构后仍可读取
+    static thread_local bool t_dead;
+};
+
+template<class T, int N>
+thread_local bool LogThreadLocal<T, N>::t_dead = false;
+
+/**
+ * @brief 日志事件携带的键值字段
+ * @details 字段和字符串内容都存放在内置数组中, 添加字段不分配内存;
+ *          超过MAX_FIELDS个或内置区放不下的字段被丢弃并计数
+ */
+class LogFields {
+public:
+    /// 最多字段数
+    static const size_t MAX_FIELDS = 16;
+    /// 键和字符串值的内置存储大小
+    static const size_t ARENA_SIZE = 512;
+
+    /**
+     * @brief 字段值类型
+     */
+    enum Type : uint8_t {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+
+    /**
+     * @brief 一个字段, 键和字符串值存放在内置区, 用offset/length引用
+     */
+    struct Field {
+        Type type;
+        uint8_t keyLength;
+        uint16_t keyOffset;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+            struct {
+                uint16_t offset;
+                uint16_t length;
+            } s;
+        };
+    };
+
+    /**
+     * @brief 添加字段
+     * @details 支持整数, 枚举, 浮点数, bool, char和字符串类型
+     * @return 放不下时返回false
+     */
+    template<class T>
+    bool add(std::string_view key, const T& v) {
+        Field f;
+        if constexpr (std::is_same<T, bool>::value) {
+            f.type = BOOL;
+            f.b = v;
+        } else if constexpr (std::is_same<T, char>::value) {
+            return addString(key, std::string_view(&v, 1));
+        } else if constexpr (std::is_floating_point<T>::value) {
+            f.type = DOUBLE;
+            f.d = v;
+        } else if constexpr (std::is_enum<T>::value
+                || (std::is_integral<T>::value && std::is_signed<T>::value)) {
+            f.type = INT;
+            f.i = (int64_t)v;
+        } else if constexpr (std::is_integral<T>::value) {
+            f.type = UINT;
+            f.u = v;
+        } else if constexpr (std::is_convertible<const T&, const char*>::value) {
+            const char* str = v;
+            return addString(key, str ? std::string_view(str) : std::string_view("(null)"));
+        } else {
+            static_assert(std::is_convertible<const T&, std::string_view>::value
+                    , "sylar::LogFields: unsupported field type");
+            return addString(key, std::string_view(v));
+        }
+        return addField(key, f);
+    }
+
+    /**
+     * @brief 返回字段数
+     */
+    size_t size() const { return m_count; }
+
+    /**
+     * @brief 是否没有字段
+     */
+    bool empty() const { return m_count == 0; }
+
+    /**
+     * @brief 返回第i个字段
+     */
+    const Field& operator[](size_t i) const { return m_fields[i]; }
+
+    /**
+     * @brief 返回字段的键
+     */
+    std::string_view key(const Field& f) const {
+        return std::string_view(m_arena + f.keyOffset, f.keyLength);
+    }
+
+    /**
+     * @brief 返回STRING字段的值
+     */
+    std::string_view str(const Field& f) const {
+        return std::string_view(m_arena + f.s.offset, f.s.length);
+    }
+
+    /**
+     * @brief 返回被丢弃的字段数
+     */
+    uint32_t getDropped() const { return m_dropped; }
+
+    /**
+     * @brief 以" key=value"的形式追加所有字段
+     */
+    void format(LogBuffer& buf) const;
+
+    /**
+     * @brief 清空字段
+     */
+    void clear() {
+        m_count = 0;
+        m_used = 0;
+        m_dropped = 0;
+    }
+private:
+    /**
+     * @brief 添加字符串字段, 值拷贝到内置区
+     */
+    bool addString(std::string_view key, std::string_view v);
+
+    /**
+     * @brief 拷贝键并添加字段
+     */
+    bool addField(std::string_view key, Field& f);
+
+    /**
+     * @brief 从内置区分配len字节, 放不下返回-1
+     */
+    int alloc(size_t len) {
+        if (len > ARENA_SIZE - m_used) {
+            return -1;
+        }
+        int offset = m_used;
+        m_used += len;
+        return offset;
+    }
+private:
+    /// 字段
+    Field m_fields[MAX_FIELDS];
+    /// 键和字符串值
+    char m_arena[ARENA_SIZE];
+    /// 字段数
+    uint16_t m_count = 0;
+    /// 内置区已用字节数
+    uint16_t m_used = 0;
+    /// 被丢弃的字段数
+    uint32_t m_dropped = 0;
+};
+
+/**
+ * @brief 日志内容流缓冲区
+ * @details 内置INLINE_SIZE字节缓冲, 只有超长日志才转到堆上
+ */
+class LogStreamBuf : public std::streambuf {
+public:
+    /// 内置缓冲区大小
+    static const size_t INLINE_SIZE = 512;
+    /// reset()时超过该大小的堆缓冲区会被释放
+    static const size_t MAX_KEEP_SIZE = 64 * 1024;
+
+    LogStreamBuf();
+    ~LogStreamBuf();
+
+    /**
+     * @brief 返回内容起始地址
+     */
+    const char* data() const { return pbase(); }
+
+    /**
+     * @brief 返回内容长度
+     */
+    size_t size() const { return pptr() - pbase(); }
+
+    /**
+     * @brief 确保至少还有len字节可写, 返回写入位置
+     */
+    char* prepare(size_t len) {
+        if ((size_t)(epptr() - pptr()) < len) {
+            grow(size() + len);
+        }
+        return pptr();
+    }
+
+    /**
+     * @brief 返回当前可直接写入的字节数
+     */
+    size_t available() const { return epptr() - pptr(); }
+
+    /**
+     * @brief 提交prepare()之后写入的长度
+     */
+    void commit(size_t len) { pbump((int)len); }
+
+    /**
+     * @brief 清空内容
+     */
+    void reset();
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+private:
+    /**
+     * @brief 扩容到至少len字节
+     */
+    void grow(size_t len);
+private:
+    /// 内置缓冲区
+    char m_inline[INLINE_SIZE];
+    /// 堆缓冲区, 未溢出时为nullptr
+    char* m_heap = nullptr;
+};
+
+/**
+ * @brief 日志内容流
+ * @details 与std::ostream兼容, 内容写入LogStreamBuf, 不做区域设置和堆分配
+ */
+class LogStream : public std::ostream {
+public:
+    LogStream();
+
+    /**
+     * @brief 返回内容起始地址
+     */
+    const char* data() const { return m_buf.data(); }
+
+    /**
+     * @brief 返回内容长度
+     */
+    size_t size() const { return m_buf.size(); }
+
+    /**
+     * @brief 返回内容的字符串拷贝
+     */
+    std::string str() const { return std::string(data(), size()); }
+
+    /**
+     * @brief 返回底层缓冲区
+     */
+    LogStreamBuf& buffer() { return m_buf; }
+
+    /**
+     * @brief 给所属的日志事件添加键值字段, 例如
+     *        SYLAR_LOG_INFO(logger).kv("user", id).kv("lat_us", t) << "done";
+     * @details 不属于日志事件的流忽略字段
+     */
+    template<class T>
+    LogStream& kv(std::string_view key, const T& v) {
+        if (m_fields) {
+            m_fields->add(key, v);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief 设置kv()写入的字段表
+     */
+    void setFields(LogFields* fields) { m_fields = fields; }
+
+    /**
+     * @brief 清空内容并恢复默认的流状态(格式标志, 精度, 宽度等)
+     */
+    void reset();
+private:
+    /// 缓冲区
+    LogStreamBuf m_buf;
+    /// 键值字段
+    LogFields* m_fields = nullptr;
+};
 
 /**
  * @brief 日志事件
@@ -106,23 +821,49 @@ public:
 	* @param[in] elapse 	 程序启动时依赖的耗时(毫秒)
 	* @param[in] thread_id 	 线程id
 	* @param[in] fiber_id  	 协程id
-	* @param[in] time        日志事件(s)
+	* @param[in] time        日志时间(自1970年起), 旧的秒数参数不能隐式转换, 须写明单位,
+	*                        例如std::chrono::microseconds(GetLogTimeUS())
 	* @param[in] thread_name 线程名称
     */
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
 			, const char* file, int32_t line, uint32_t elapse
-			, uint32_t thread_id, uint32_t fiber_id, uint64_t time
+			, uint32_t thread_id, uint32_t fiber_id, std::chrono::microseconds time
 			, const std::string& thread_name);
 
+   /**
+	* @brief 构造函数, 文件名和行号来自调用点
+	* @param[in] logger 	 日志器
+	* @param[in] site   	 调用点
+	* @param[in] level  	 日志级别
+	* @param[in] elapse 	 程序启动时依赖的耗时(毫秒)
+	* @param[in] thread_id 	 线程id
+	* @param[in] fiber_id  	 协程id
+	* @param[in] time        日志时间(微秒), 见GetLogTimeUS()
+	* @param[in] thread_name 线程名称
+    */
+    LogEvent(std::shared_ptr<Logger> logger, const LogCallSite& site, LogLevel::Level level
+			, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id
+			, uint64_t time, const std::string& thread_name);
+
 	/**
  	* @brief 返回文件名
  	*/
-    const char* getFile() const { return m_file; }
+    const char* getFile() const { return m_site->info.file; }
 	
 	/**
  	* @brief 返回行号
  	*/
-    int32_t getLine() const { return m_line; }
+    int32_t getLine() const { return m_site->info.line; }
+
+	/**
+ 	* @brief 返回函数名
+ 	*/
+    const char* getFunc() const { return m_site->info.func; }
+
+	/**
+ 	* @brief 返回调用点
+ 	*/
+    const LogCallSite& getSite() const { return *m_site; }
 	
 	/**
  	* @brief 返回耗时
@@ -140,9 +881,14 @@ public:
     uint32_t getFiberId() const { return m_fiberId; }
 
 	/**
- 	* @brief 返回时间 
+ 	* @brief 返回时间(秒)
+ 	*/
+    uint64_t getTime() const { return m_time / 1000000; }
+
+	/**
+ 	* @brief 返回时间(微秒)
  	*/
-    uint64_t getTime() const { return m_time; }
+    uint64_t getTimeUS() const { return m_time; }
 
 	/**
  	* @brief 返回线程名称
@@ -152,73 +898,103 @@ public:
 	/**
  	* @brief 返回日志内容
  	*/
-    const std::string& getContent() { return m_content; }
+    std::string getContent() const { return m_ss.str(); }
 
-	std::shared_ptr<Logger> getLogger() const { return m_logger; }
+	/**
+ 	* @brief 返回日志内容(不拷贝)
+ 	*/
+    std::string_view getContentView() const { return std::string_view(m_ss.data(), m_ss.size()); }
+
+	const std::shared_ptr<Logger>& getLogger() const { return m_logger; }
 	
 	LogLevel::Level getLevel() const { return m_level; }
 
-	std::stringstream& getSS() { return m__ss; }
+	LogStream& getSS() { return m_ss; }
+
+	/**
+ 	* @brief 返回键值字段
+ 	*/
+	const LogFields& getFields() const { return m_fields; }
+
+	LogFields& getFields() { return m_fields; }
 	
 	void format(const char* fmt, ...);
 
 	void format(const char* fmt, va_list al);
 private:
-	/// 文件名
-    const char* m_file = nullptr; 
-	/// 行号
-    int32_t m_line = 0;          
+	friend class LogEventPool;
+
+	/**
+	 * @brief 复用事件, 重新设置所有字段并清空内容流
+	 * @details 参数同构造函数, 内容流和线程名称保留已分配的内存
+	 */
+    void reset(std::shared_ptr<Logger> logger, const LogCallSite& site, LogLevel::Level level
+			, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id
+			, uint64_t time, const std::string& thread_name);
+private:
+	/// 调用点
+    const LogCallSite* m_site = nullptr;
+	/// 按文件名和行号构造时持有的调用点
+    std::unique_ptr<LogCallSite> m_ownSite;
 	/// 程序启动开始到现在的毫秒数
     uint32_t m_elapse = 0;        
 	/// 线程id
     uint32_t m_threadId = 0;      
 	/// 协程id
     uint32_t m_fiberId = 0;       
-	/// 时间戳
+	/// 时间戳(微秒)
     uint64_t m_time;               
 	/// 线程名称
 	std::string m_threadName;
 	/// 日志内容流
-	std::stringstream m_ss;
+	LogStream m_ss;
+	/// 键值字段
+	LogFields m_fields;
 	/// 日志器
 	std::shared_ptr<Logger> m_logger;
 	/// 日志等级
 	LogLevel::Level m_level;
+	/// 是否由事件池持有
+	bool m_pooled = false;
 };
 
 
 /**
- * @brief 日志级别 
+ * @brief 线程本地日志事件池
+ * @details 每个线程缓存一组LogEvent(连同shared_ptr控制块和内容流),
+ *          事件只被池持有(use_count()==1)时即可复用, 包括在其他线程
+ *          (如AsyncLogAppender后台线程)释放的事件. 稳定运行时取事件不分配内存.
+ *          最后一个池外持有者通过Release释放事件, 同时释放事件对logger的引用.
+ *          线程的事件池析构后(如在thread_local析构函数中写日志)直接分配事件
  */
-
-class LogLevel {
+class LogEventPool {
 public:
-    enum Level {
-	// 未知级别
-        UNKNOW = 0,
-	// DEBUG 级别
-        DEBUG = 1,
-	// INFO 级别
-        INFO = 2,
-	// WARN 级别
-        WARN = 3,
-	// ERROR 级别
-        ERROR = 4,
-	// FATAL 级别
-        FATAL = 5
-    };
-     
-	/**
- 	* @brief 将日志级别转换成文本输出 
- 	*/
-    	static const char* ToString(LogLevel::Level);
-					
-	/**
- 	* @brief 将文本输出转换成日志级别
- 	*/
-	static LogLevel::Level FronmString(const std::string& str);
+    /// 每个线程最多缓存的事件数, 超过后直接分配不入池
+    static const size_t MAX_EVENTS = 64;
+
+    /**
+     * @brief 从当前线程的事件池取一个事件, 参数同LogEvent构造函数
+     */
+    static LogEvent::ptr Acquire(std::shared_ptr<Logger> logger, const LogCallSite& site
+            , LogLevel::Level level, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            , const std::string& thread_name);
+
+    /**
+     * @brief 释放事件, 是最后一个池外持有者时先释放事件对logger的引用
+     */
+    static void Release(LogEvent::ptr& event);
+
+    /**
+     * @brief 析构函数, 标记当前线程的事件池已析构
+     */
+    ~LogEventPool();
+private:
+    /// 缓存的事件
+    std::vector<LogEvent::ptr> m_events;
+    /// 下次优先检查的位置
+    size_t m_next = 0;
 };
- 
+
 /**
  * @brief 日志事件包装器
  */
@@ -245,7 +1021,7 @@ public:
 	/**
 	 * @brief 获取日志内容流
 	 */
-	std::stringstream& getSS();
+	LogStream& getSS();
 private:
 
 	/**
@@ -255,34 +1031,209 @@ private:
 };
 
 /**
- * @brief 日志格式化
+ * @brief 日志输出缓冲区
+ * @details 连续内存, clear()后保留容量, 复用时不再分配内存
  */
-
-class LogFormatter {
+class LogBuffer {
 public:
-	typedef std::shared_ptr<LogFormatter> ptr;
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 初始容量
+     */
+    LogBuffer(size_t capacity = 256);
+
+    /**
+     * @brief 析构函数
+     */
+    ~LogBuffer();
+
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    /**
+     * @brief 追加数据
+     */
+    void append(const char* data, size_t len) {
+        memcpy(reserve(len), data, len);
+        m_size += len;
+    }
+
+    /**
+     * @brief 追加字符串
+     */
+    void append(const std::string& str) { append(str.data(), str.size()); }
+
+    /**
+     * @brief 追加C字符串, 空指针不输出
+     */
+    void append(const char* str) {
+        if (str) {
+            append(str, strlen(str));
+        }
+    }
+
+    /**
+     * @brief 追加十进制无符号整数
+     */
+    void appendUInt(uint64_t v) {
+        m_size += FormatUInt(reserve(20), v);
+    }
+
+    /**
+     * @brief 追加十进制有符号整数
+     */
+    void appendInt(int64_t v) {
+        if (v < 0) {
+            append('-');
+            appendUInt(-(uint64_t)v);
+        } else {
+            appendUInt(v);
+        }
+    }
+
+    /**
+     * @brief 追加浮点数(能精确还原的最短形式)
+     */
+    void appendDouble(double v) {
+        char* p = reserve(32);
+        m_size += std::to_chars(p, p + 32, v).ptr - p;
+    }
+
+    /**
+     * @brief 追加单个字符
+     */
+    void append(char c) {
+        *reserve(1) = c;
+        ++ m_size;
+    }
+
+    /**
+     * @brief 确保至少还有len字节可写, 返回写入位置
+     * @details 写入后需调用commit()提交实际写入长度
+     */
+    char* reserve(size_t len) {
+        if (m_size + len > m_capacity) {
+            grow(m_size + len);
+        }
+        return m_data + m_size;
+    }
+
+    /**
+     * @brief 提交reserve()之后写入的长度
+     */
+    void commit(size_t len) { m_size += len; }
+
+    /**
+     * @brief 返回数据起始地址
+     */
+    const char* data() const { return m_data; }
+
+    /**
+     * @brief 返回数据长度
+     */
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief 清空数据, 保留容量
+     */
+    void clear() { m_size = 0; }
+
+    /**
+     * @brief 返回数据的字符串拷贝
+     */
+    std::string toString() const { return std::string(m_data, m_size); }
+
+    /**
+     * @brief 十进制位数
+     */
+    static size_t DigitCount(uint64_t v) {
+        size_t n = 1;
+        while (true) {
+            if (v < 10) return n;
+            if (v < 100) return n + 1;
+            if (v < 1000) return n + 2;
+            if (v < 10000) return n + 3;
+            v /= 10000;
+            n += 4;
+        }
+    }
+
+    /**
+     * @brief 把v的十进制写入p(至少20字节), 返回长度
+     * @details 先算位数, 再从低位起每次查表写两位, 不需要反转或移动
+     */
+    static size_t FormatUInt(char* p, uint64_t v) {
+        static constexpr char s_pairs[] =
+            "00010203040506070809101112131415161718192021222324"
+            "25262728293031323334353637383940414243444546474849"
+            "50515253545556575859606162636465666768697071727374"
+            "75767778798081828384858687888990919293949596979899";
+        size_t len = DigitCount(v);
+        char* d = p + len;
+        while (v >= 100) {
+            d -= 2;
+            memcpy(d, s_pairs + v % 100 * 2, 2);
+            v /= 100;
+        }
+        if (v >= 10) {
+            memcpy(d - 2, s_pairs + v * 2, 2);
+        } else {
+            d[-1] = '0' + v;
+        }
+        return len;
+    }
+private:
+    /**
+     * @brief 扩容到至少len字节
+     */
+    void grow(size_t len);
+private:
+    /// 数据
+    char* m_data;
+    /// 数据长度
+    size_t m_size = 0;
+    /// 容量
+    size_t m_capacity;
+};
+
+/**
+ * @brief 日志格式化
+ * @details init()把日志模板编译成一组操作码和字面量片段,
+ *          格式化时按操作码顺序直接写入调用方提供的LogBuffer
+ */
+
+class LogFormatter {
+public:
+	typedef std::shared_ptr<LogFormatter> ptr;
 	/**
 	 * @brief 构造函数
  	 * param[in] pattern 格式模版
 	 * @details 
-	 * %m 消息
+	 * %m 消息, %m{text}把控制字符转义成\\n, \\xHH等, 保证一条日志一行;
+	 *    %m{json}按JSON字符串转义(不加引号)
 	 * %p 日志级别
 	 * %r 累计毫秒数
 	 * %c 日志名称
 	 * %t 线程id
  	 * %n 换行
-	 * %d 时间
+	 * %d 时间, %d{fmt}中fmt为strftime格式, 另支持%L毫秒(3位), %f微秒(6位)
  	 * %f 文件名
 	 * %l 行号
 	 * %T 制表符
 	 * %F 协程id
 	 * %N 线程名称
+	 * %K 键值字段, 每个字段输出为" key=value"
 	 *
 	 * 默认格式 “%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
  	 *
 	 */
    	LogFormatter(const std::string& pattern);
 
+	/**
+	 * @brief 析构函数
+	 */
+    virtual ~LogFormatter() {}
+
 	/**
 	 * @brief 返回格式化日志文本
 	 * @param[in] logger 日志器
@@ -292,29 +1243,144 @@ public:
 		
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
  	std::ostream& format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+
+	/**
+	 * @brief 格式化日志, 追加到buf
+	 * @param[in, out] buf 输出缓冲区
+	 * @param[in] logger 日志器
+	 * @param[in] level 日志级别
+	 * @param[in] event 日志事件
+	 */
+    virtual void format(LogBuffer& buf, const Logger& logger, LogLevel::Level level, const LogEvent& event) const;
 public:
- 
  	/** 
- 	 * @brief 日志内容项格式化
+ 	 * @brief 消息转义方式
 	 */
+    enum Escape {
+        /// 原样输出
+        ESCAPE_NONE,
+        /// 转义控制字符(含换行, 制表符和DEL)
+        ESCAPE_TEXT,
+        /// 转义JSON字符串中的引号, 反斜杠和控制字符
+        ESCAPE_JSON
+    };
 
-    class FormatItem {
-    public:
-    typedef std::shared_ptr<FormatItem> ptr;
  	/** 
- 	 * @brief 析构函数
+ 	 * @brief 转义后追加到buf
+ 	 * @details 用SIMD(AVX2/SSE2)每次检查32/16字节, 只在遇到需要转义的字节时
+ 	 *          逐字节处理, 其余部分整段拷贝
 	 */
-    virtual ~FormatItem() {}
-	/**
-	 * @brief 格式化日志到流
- 	 * @param[in, out] os 日志输出流
-	 * @param[in] logger 日志器
-	 * @param[in] level 日志等级
-	 * @param[in] event 日志事件
+    static void AppendEscaped(LogBuffer& buf, const char* str, size_t len, Escape mode);
+
+ 	/** 
+ 	 * @brief 转义字节的查找实现
+	 */
+    enum EscapeScanner {
+        /// 按CPU选择
+        SCAN_AUTO,
+        /// 逐字节
+        SCAN_SCALAR,
+        /// SSE2
+        SCAN_SSE2,
+        /// AVX2
+        SCAN_AVX2
+    };
+
+ 	/** 
+ 	 * @brief 返回str中第一个需要转义的字节的位置, 没有时返回len
+ 	 * @param[in] scanner 指定实现(用于测试), 当前平台或CPU不支持时按SCAN_AUTO处理
 	 */
-    virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    static size_t FindEscape(const char* str, size_t len, Escape mode, EscapeScanner scanner = SCAN_AUTO);
+
+ 	/** 
+ 	 * @brief 模板编译后的操作码
+	 */
+    enum OpCode : uint8_t {
+        /// 字面量片段
+        OP_LITERAL,
+        /// %m 消息
+        OP_MESSAGE,
+        /// %p 日志级别
+        OP_LEVEL,
+        /// %r 累计毫秒数
+        OP_ELAPSE,
+        /// %c 日志名称
+        OP_NAME,
+        /// %t 线程id
+        OP_THREAD_ID,
+        /// %n 换行
+        OP_NEWLINE,
+        /// %d 时间
+        OP_DATETIME,
+        /// %f 文件名
+        OP_FILENAME,
+        /// %l 行号
+        OP_LINE,
+        /// %T 制表符
+        OP_TAB,
+        /// %F 协程id
+        OP_FIBER_ID,
+        /// %N 线程名称
+        OP_THREAD_NAME,
+        /// %K 键值字段
+        OP_FIELDS
+    };
+
+ 	/** 
+ 	 * @brief 一条指令, offset/length指向m_literals中的字面量或子格式
+	 */
+    struct Op {
+        OpCode code;
+        uint32_t offset;
+        uint32_t length;
     };
 
+ 	/** 
+ 	 * @brief 执行一条指令
+ 	 * @param[in] arg 字面量或子格式起始地址
+ 	 * @param[in] len 字面量或子格式长度
+	 */
+    template<OpCode C>
+    static void ExecuteOp(LogBuffer& buf, const char* arg, uint32_t len
+            , const Logger& logger, LogLevel::Level level, const LogEvent& event);
+
+ 	/** 
+ 	 * @brief 输出线程id
+ 	 * @details 每个线程缓存上一次渲染的线程id文本, 一般就是本线程的id,
+ 	 *          命中时只拷贝几个字节
+	 */
+    static void AppendThreadId(LogBuffer& buf, uint32_t thread_id) {
+        static thread_local struct {
+            uint32_t id = 0;
+            uint32_t len = 1;
+            char str[20] = {'0'};
+        } t_cache;
+        if (t_cache.id != thread_id) {
+            t_cache.id = thread_id;
+            t_cache.len = LogBuffer::FormatUInt(t_cache.str, thread_id);
+        }
+        buf.append(t_cache.str, t_cache.len);
+    }
+
+ 	/** 
+ 	 * @brief 按%d{fmt}格式输出时间
+ 	 * @param[in] fmt 时间格式, 长度为0时使用默认格式"%Y:%m:%d %H:%M:%S"
+ 	 * @param[in] len 时间格式长度
+ 	 * @param[in] time_us 时间(微秒)
+ 	 * @details 每个线程按格式缓存当前秒的格式化结果,
+ 	 *          同一秒内的日志只拷贝缓存并填入毫秒/微秒, 不再调用localtime_r和strftime
+	 */
+    static void FormatTime(LogBuffer& buf, const char* fmt, uint32_t len, uint64_t time_us);
+
+ 	/** 
+ 	 * @brief 编译期解析日志模板
+ 	 * @param[in] pattern 日志模板
+ 	 * @param[out] ops 指令输出, 为nullptr时只计数
+ 	 * @return 指令数, 模板有错误时返回-1
+ 	 * @details 字面量和子格式的offset指向pattern本身, %%拆成单个'%'字面量
+	 */
+    static constexpr int Compile(const char* pattern, Op* ops);
+
  	/** 
  	 * @brief 初始化，解析日志模板
 	 */
@@ -329,26 +1395,238 @@ public:
  	 * @brief 返回日志模板
 	 */
 	const std::string getPattern() const { return m_pattern; }
+private:
+ 	/** 
+ 	 * @brief 追加一条指令, 相邻字面量合并成一个片段
+	 */
+    void addOp(OpCode code, const std::string& arg = "");
 private:
 	/// 日志格式模板
     std::string m_pattern;
-	/// 日志格式解析后格式
-    std::vector<FormatItem::ptr> m_item;
+	/// 编译后的指令序列
+    std::vector<Op> m_ops;
+	/// 字面量片段和子格式
+    std::string m_literals;
  	/// 是否有错误
 	bool m_error = false;
 };
 
+/**
+ * @brief JSON日志格式化
+ * @details 每条日志输出为一行JSON对象, 依次是time, level, logger, thread, thread_name,
+ *          fiber, file, line, msg和事件的键值字段. 直接写入LogBuffer, 不构造中间对象
+ */
+class JsonLogFormatter : public LogFormatter {
+public:
+    typedef std::shared_ptr<JsonLogFormatter> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] time_format time字段的strftime格式, 支持%L毫秒和%f微秒
+     */
+    JsonLogFormatter(const std::string& time_format = "%Y-%m-%dT%H:%M:%S.%f%z");
+
+    using LogFormatter::format;
+
+    void format(LogBuffer& buf, const Logger& logger, LogLevel::Level level, const LogEvent& event) const override;
+
+    /**
+     * @brief 追加带引号并转义的JSON字符串
+     */
+    static void AppendString(LogBuffer& buf, const char* str, size_t len);
+private:
+    /// time字段格式
+    std::string m_timeFormat;
+};
+
+/**
+ * @brief 日志自身的统计
+ * @details 计数器按线程分片(每片独占缓存行), 写入是对本线程分片的relaxed原子加,
+ *          读取时汇总所有分片. 格式化和写出耗时每SAMPLE_RATE条采样一次,
+ *          按2的幂分桶: 第k个桶为[2^k, 2^(k+1))纳秒
+ */
+class LogMetrics {
+public:
+    /// 分片数
+    static constexpr size_t SHARDS = 16;
+    /// 日志级别数
+    static constexpr size_t LEVELS = LogLevel::FATAL + 1;
+    /// 耗时直方图的桶数
+    static constexpr size_t BUCKETS = 32;
+    /// 耗时采样间隔(条)
+    static constexpr uint32_t SAMPLE_RATE = 16;
+
+    /**
+     * @brief 耗时统计的阶段
+     */
+    enum Stage {
+        /// 格式化
+        FORMAT = 0,
+        /// 写出(异步Appender为入队)
+        WRITE = 1,
+        STAGES = 2
+    };
+
+    /**
+     * @brief 统计快照
+     */
+    struct Snapshot {
+        /// 日志器名称或Appender类型
+        std::string name;
+        /// 按级别的接受数
+        uint64_t accepted[LEVELS] = {};
+        /// 按级别的过滤数
+        uint64_t filtered[LEVELS] = {};
+        /// 写出的字节数
+        uint64_t bytes = 0;
+        /// 丢弃(或被合并)的日志数
+        uint64_t dropped = 0;
+        /// 队列中等待的日志数
+        uint64_t queueDepth = 0;
+        /// 耗时直方图
+        uint64_t latency[STAGES][BUCKETS] = {};
+
+        /**
+         * @brief 返回耗时的p分位数(0~1)所在桶的上界(纳秒), 没有样本返回0
+         */
+        uint64_t percentile(Stage stage, double p) const;
+    };
+
+    /**
+     * @brief 记录一条被接受的日志
+     */
+    void accept(LogLevel::Level level) {
+        shard().accepted[Index(level)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 记录一条被级别过滤的日志
+     */
+    void filter(LogLevel::Level level) {
+        shard().filtered[Index(level)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 记录写出的字节数
+     */
+    void addBytes(uint64_t bytes) {
+        shard().bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 记录一个阶段的耗时
+     */
+    void record(Stage stage, uint64_t ns) {
+        size_t bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        shard().latency[stage][bucket < BUCKETS ? bucket : BUCKETS - 1]
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 当前线程的这一条日志是否采样耗时
+     */
+    static bool Sample() {
+        static thread_local uint32_t t_count = 0;
+        return t_count++ % SAMPLE_RATE == 0;
+    }
+
+    /**
+     * @brief 单调时钟(纳秒)
+     */
+    static uint64_t Now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    /**
+     * @brief 把所有分片累加到snapshot
+     */
+    void snapshot(Snapshot& snapshot) const;
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> accepted[LEVELS] = {};
+        std::atomic<uint64_t> filtered[LEVELS] = {};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> latency[STAGES][BUCKETS] = {};
+    };
+
+    static size_t Index(LogLevel::Level level) {
+        return (size_t)level < LEVELS ? level : 0;
+    }
+
+    /**
+     * @brief 当前线程的分片
+     */
+    Shard& shard() {
+        static thread_local size_t t_shard = NextShard();
+        return m_shards[t_shard];
+    }
+
+    /**
+     * @brief 为新线程分配分片
+     */
+    static size_t NextShard();
+private:
+    Shard m_shards[SHARDS];
+};
+
 class LogAppender {
 public:
     typedef std::shared_ptr<LogAppender> ptr;
     virtual ~LogAppender() {}
      
     virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+
+    /**
+     * @brief 是否支持write()
+     * @details 支持时Logger::log()用本Appender的formatter格式化后调用write(),
+     *          同一日志器下使用同一个formatter的Appender每条日志只格式化一次
+     */
+    virtual bool acceptsFormatted() const { return false; }
+
+    /**
+     * @brief 写入已用本Appender的formatter格式化好的日志
+     * @param[in] level 日志级别
+     * @param[in] event 日志事件
+     * @param[in] data 格式化结果
+     * @param[in] len 格式化结果长度
+     */
+    virtual void write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) {}
+
     void setFormatter(LogFormatter::ptr val) { m_formatter = val; }
     LogFormatter::ptr getFormatter() const { return m_formatter; }
+
+    /**
+     * @brief 返回formatter, 不增加引用计数
+     */
+    const LogFormatter* getFormatterPtr() const { return m_formatter.get(); }
+
+    /**
+     * @brief 返回日志级别
+     */
+    LogLevel::Level getLevel() const { return m_level; }
+
+    /**
+     * @brief level是否达到本Appender的级别, 未达到时计入过滤数
+     */
+    bool accepts(LogLevel::Level level) {
+        if (level < m_level) {
+            m_metrics.filter(level);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 返回统计快照
+     */
+    virtual LogMetrics::Snapshot getMetrics() const;
 protected:
-    LogLevel::Level m_level;
+    LogLevel::Level m_level = LogLevel::DEBUG;
     LogFormatter::ptr m_formatter;
+    /// 统计
+    LogMetrics m_metrics;
 };
 
 
@@ -358,7 +1636,15 @@ protected:
 class Logger : public std::enable_shared_from_this<Logger> {
 public:
     typedef std::shared_ptr<Logger> ptr;
+    friend class LoggerManager;
     Logger(const std::string& name = "root");
+    ~Logger();
+
+    /**
+     * @brief 写日志到本日志器及父日志器的Appender
+     * @details 支持write()的Appender按formatter分组, 每个formatter只格式化一次,
+     *          级别低于Appender级别的在格式化之前跳过
+     */
     void log(LogLevel::Level level, LogEvent::ptr event);
 
     void debug(LogEvent::ptr event);
@@ -367,42 +1653,1703 @@ public:
     void error(LogEvent::ptr event);
     void fatal(LogEvent::ptr event);
      
+    /**
+     * @brief 添加Appender
+     * @details Appender列表是不可变快照, 修改时复制一份再原子地发布, 不等待正在进行的log().
+     *          旧快照在所有可能读到它的log()结束后, 由之后不在log()中的修改者释放,
+     *          不在写日志的线程上释放. log()不加锁也不增加共享的引用计数.
+     *          可以在Appender::log中调用
+     */
     void addAppender(LogAppender::ptr appender);
+
+    /**
+     * @brief 删除Appender
+     * @details 不在log()中调用时, 等待所有可能读到旧快照的log()结束后返回,
+     *          返回后不会再有线程通过本日志器调用它. 在Appender::log中调用时不等待
+     *          (等待会包括自己所在的log()), 其他线程正在进行的log()仍可能调用它一次
+     */
     void delAppender(LogAppender::ptr appender);
-    LogLevel::Level getLevel() const { return m_level; }
-    void setLevel(LogLevel::Level val) { m_level = val; }
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 设置日志级别, 同时传给没有单独设置级别的子日志器
+     */
+    void setLevel(LogLevel::Level val);
+
+    /**
+     * @brief 取消单独设置的级别, 改为继承父日志器的级别
+     */
+    void resetLevel();
+
+    /**
+     * @brief 返回统计快照
+     * @details 第一项是日志器本身(到达log()的日志按级别的接受/过滤数),
+     *          之后依次是本日志器的每个Appender. 在调用点被过滤的语句不计数,
+     *          以保持关闭的日志只有一次读取
+     */
+    std::vector<LogMetrics::Snapshot> getMetrics() const;
+
+    /**
+     * @brief 返回父日志器, 没有返回nullptr
+     * @details 日志同时写入父日志器(直到root)的Appender
+     */
+    Logger::ptr getParent() const { return m_parent; }
     
-    const std::string& getName() { return m_name; }
+    const std::string& getName() const { return m_name; }
+
+    /**
+     * @brief 返回进程内唯一的日志器id
+     */
+    uint32_t getId() const { return m_id; }
+
+    /**
+     * @brief 设置二进制日志输出, 设置后SYLAR_LOG_FMT_*只写二进制记录, 不经过Appender
+     * @details 被替换的writer保留到日志器析构, 正在写入的线程不受影响
+     */
+    void setBinaryWriter(std::shared_ptr<BinaryLogWriter> writer);
+
+    /**
+     * @brief 返回二进制日志输出, 未设置返回nullptr
+     */
+    BinaryLogWriter* getBinaryWriter() const { return m_binaryWriter.load(std::memory_order_acquire); }
+private:
+    /**
+     * @brief 把本日志器的级别传给没有单独设置级别的子日志器
+     */
+    void propagateLevel();
 private:
     std::string m_name;                       // Log Name
-    LogLevel::Level m_level;                  // Log Level
-    std::list<LogAppender::ptr> m_appenders;  // Log AppenderSet
+    std::atomic<LogLevel::Level> m_level{LogLevel::DEBUG}; // Log Level
+    bool m_levelSet = false;                  // Level set explicitly
+    Logger::ptr m_parent;                     // Parent Logger
+    std::vector<Logger*> m_children;          // Child Loggers
+    std::atomic<const std::vector<LogAppender::ptr>*> m_appenders; // Log AppenderSet snapshot
+    std::mutex m_appenderMutex;
+    LogMetrics m_metrics;                     // Log Metrics
     LogFormatter::ptr m_formatter;
+    uint32_t m_id;                            // Log Id
+    std::atomic<BinaryLogWriter*> m_binaryWriter{nullptr};
+    std::vector<std::shared_ptr<BinaryLogWriter> > m_binaryWriters;
+    std::mutex m_binaryMutex;
+};
+
+/**
+ * @brief 崩溃时需要写出缓冲日志的对象
+ * @details 实现者在构造完成后调用LogCrashHandler::Register登记, 析构开始时注销
+ */
+class LogCrashFlushable {
+public:
+    /**
+     * @brief 写出阶段, 前一阶段的对象全部写出后才开始下一阶段
+     */
+    enum Stage {
+        /// 由后台线程写出的队列, 等待后台线程处理完
+        QUEUE = 0,
+        /// 可以直接write(2)写出的缓冲
+        BUFFER = 1
+    };
+
+    virtual ~LogCrashFlushable() {}
+
+    /**
+     * @brief 写出缓冲中的日志, 可能在信号处理函数中调用
+     * @details 只能使用异步信号安全的操作: 不分配内存, 不阻塞加锁, 等待不超过deadline
+     * @param[in] deadline 截止时刻(CLOCK_MONOTONIC纳秒)
+     * @param[in] record 追加到日志文件末尾的崩溃记录, 可为nullptr
+     * @param[in] len 崩溃记录长度
+     */
+    virtual void crashFlush(uint64_t deadline, const char* record, size_t len) = 0;
+};
+
+/**
+ * @brief 致命信号时写出异步队列和缓冲中的日志
+ * @details 需要显式调用Install开启. 收到SIGSEGV/SIGABRT/SIGBUS/SIGFPE时, 先等待异步队列的
+ *          后台线程写完已入队的日志, 再用write(2)直接写出批量缓冲, 每线程环和二进制日志缓冲,
+ *          并在标准错误和各日志文件末尾追加一条崩溃记录(信号, 线程id, 协程id), 然后恢复原来的
+ *          处理方式并重新触发信号. 等待受timeout_ms限制, 另用alarm兜底卡在内核中的写入,
+ *          超时后直接按默认方式处理信号. 备用信号栈只为调用Install的线程设置.
+ *          每个阶段最多登记MAX_FLUSHABLES个对象, 超出的对象崩溃时不会写出, 登记失败时
+ *          向标准错误输出一次警告
+ */
+class LogCrashHandler {
+public:
+    /// 每个阶段可登记的对象数上限
+    static constexpr size_t MAX_FLUSHABLES = 64;
+
+    /**
+     * @brief 安装信号处理函数, 重复调用只更新参数
+     * @param[in] timeout_ms 写出的时间上限(毫秒)
+     * @param[in] flush_on_fatal 每条FATAL日志写完后是否也写出一次
+     * @return 是否成功
+     */
+    static bool Install(uint32_t timeout_ms = 1000, bool flush_on_fatal = true);
+
+    /**
+     * @brief 恢复安装前的信号处理方式
+     */
+    static void Uninstall();
+
+    /**
+     * @brief 是否已安装
+     */
+    static bool IsInstalled();
+
+    /**
+     * @brief 写出所有登记对象中的日志, 异步信号安全
+     * @param[in] record 崩溃记录, 可为nullptr
+     * @param[in] len 崩溃记录长度
+     */
+    static void Flush(const char* record = nullptr, size_t len = 0);
+
+    /**
+     * @brief 开启了flush_on_fatal时调用Flush(由Logger在FATAL日志写完后调用)
+     */
+    static void FlushOnFatal();
+
+    /**
+     * @brief 登记对象
+     * @return 该阶段已登记MAX_FLUSHABLES个对象时返回false, 并警告一次
+     */
+    static bool Register(LogCrashFlushable* flushable, LogCrashFlushable::Stage stage);
+
+    /**
+     * @brief 注销对象
+     * @details 等待正在进行的Flush()(如其他线程FATAL日志触发的FlushOnFatal())结束后返回,
+     *          返回后可以销毁对象. 不能在crashFlush()或信号处理函数中调用
+     */
+    static void Unregister(LogCrashFlushable* flushable);
+
+    /**
+     * @brief 返回CLOCK_MONOTONIC纳秒, 异步信号安全
+     */
+    static uint64_t Now();
+
+    /**
+     * @brief 在deadline前反复尝试加锁, 超时返回false
+     */
+    static bool TryLock(std::mutex& mutex, uint64_t deadline);
 };
 
 // Output stdout Appender
 
-class StdoutLogAppender : public LogAppender {
+/**
+ * @brief 批量写出
+ * @details 格式化好的日志拷贝进固定大小的块, 累计到max_bytes, 或最早一条等待超过
+ *          linger_ms(由后台线程检查), 或遇到要求立即写出的日志时, 用一次writev写出
+ *          所有块. 写出时交换双缓冲, 追加只在拷贝期间持锁; 块循环复用
+ */
+class BatchLogWriter {
+public:
+    typedef std::shared_ptr<BatchLogWriter> ptr;
+    /// 实际写出, 需要处理部分写
+    typedef std::function<bool(const struct iovec* iov, int iovcnt)> Sink;
+    /// 每个块的大小
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    /**
+     * @brief 构造函数, 启动后台线程
+     * @param[in] sink 写出函数
+     * @param[in] max_bytes 累计达到该长度时写出
+     * @param[in] linger_ms 日志最长在缓冲中停留的毫秒数
+     */
+    BatchLogWriter(Sink sink, size_t max_bytes = 64 * 1024, uint32_t linger_ms = 10);
+
+    /**
+     * @brief 析构函数, 停止后台线程并写出剩余日志
+     */
+    ~BatchLogWriter();
+
+    /**
+     * @brief 追加一条日志
+     * @param[in] flush_now 是否立即写出(如FATAL)
+     */
+    void append(const char* data, size_t len, bool flush_now = false);
+
+    /**
+     * @brief 写出缓冲中的全部日志
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时用write(2)把缓冲中的日志直接写到fd, 异步信号安全
+     * @param[in] fd 文件描述符
+     * @param[in] deadline 等待锁的截止时刻(CLOCK_MONOTONIC纳秒)
+     */
+    void crashFlush(int fd, uint64_t deadline);
+private:
+    /**
+     * @brief 一组块
+     */
+    struct Batch {
+        std::vector<std::unique_ptr<char[]> > chunks;
+        /// 使用中的块数
+        size_t count = 0;
+        /// 最后一个使用中的块已用的字节数
+        size_t tail = 0;
+        /// 总字节数
+        size_t bytes = 0;
+    };
+
+    /**
+     * @brief 后台线程, 按linger_ms写出
+     */
+    void run();
+private:
+    Sink m_sink;
+    size_t m_maxBytes;
+    uint32_t m_linger;
+    /// 追加中的缓冲
+    Batch m_active;
+    /// 写出中的缓冲
+    Batch m_flushing;
+    /// 写出用的iovec, 复用
+    std::vector<struct iovec> m_iov;
+    bool m_stopping = false;
+    /// 保护m_active
+    std::mutex m_mutex;
+    /// 串行化写出, 保证顺序
+    std::mutex m_flushMutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+class StdoutLogAppender : public LogAppender, public LogCrashFlushable {
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
+    ~StdoutLogAppender();
     void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+    bool acceptsFormatted() const override { return true; }
+    void write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) override;
+
+    /**
+     * @brief 开启批量写出(在开始写日志前调用), 之后直接writev到标准输出而不经过std::cout
+     * @param[in] max_bytes 累计达到该长度时写出
+     * @param[in] linger_ms 日志最长在缓冲中停留的毫秒数
+     */
+    void setBatch(size_t max_bytes = 64 * 1024, uint32_t linger_ms = 10);
+
+    /**
+     * @brief 写出批量缓冲中的日志
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时写出批量缓冲(开启批量写出后登记)
+     */
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override;
+
+    LogMetrics::Snapshot getMetrics() const override;
 private:
+    BatchLogWriter::ptr m_batch;
 };
  
+/**
+ * @brief 内存映射的分段文件写入
+ * @details 文件按segment_size预分配(fallocate)并mmap成一个段, 写入时用原子游标
+ *          在段内预留空间后直接memcpy, 不做系统调用; 跨越段尾的那次写入负责映射
+ *          下一段并发布, 文件内容连续. 数据进入映射后由内核回写, 进程崩溃不丢失.
+ *          正常关闭时文件截断到实际长度, 崩溃时文件尾部可能留有未写入的0字节.
+ *          超过段大小的记录连续写过多个段. 退役的段结构放入空闲表供之后的段复用,
+ *          常驻的段结构只有当前段和刚退役的段. 映射失败(如地址空间耗尽)后改为用pwrite追加,
+ *          不再映射
+ */
+class MmapFileWriter {
+public:
+    typedef std::shared_ptr<MmapFileWriter> ptr;
+
+    /**
+     * @brief 构造函数, 打开文件并映射第一段(追加到已有内容之后)
+     * @param[in] filename 文件名
+     * @param[in] segment_size 段大小, 向上取整为页大小的整数倍
+     */
+    MmapFileWriter(const std::string& filename, size_t segment_size);
+
+    /**
+     * @brief 析构函数, 解除映射并把文件截断到实际长度
+     */
+    ~MmapFileWriter();
+
+    /**
+     * @brief 是否可写
+     */
+    bool isOpen() const {
+        return m_current.load(std::memory_order_acquire) != nullptr || m_direct.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 写入一条记录
+     * @return 文件不可写时返回false
+     */
+    bool write(const char* data, size_t len);
+private:
+    /**
+     * @brief 一个映射段
+     */
+    struct Segment {
+        /// 映射起始地址, 解除映射后为nullptr
+        char* base = nullptr;
+        /// 段在文件中的偏移, 段结构被复用时改变
+        std::atomic<uint64_t> offset{0};
+        /// 写游标(段内偏移), 可能超过段大小
+        std::atomic<size_t> cursor{0};
+        /// 正在访问该段的写入数
+        std::atomic<int> inflight{0};
+    };
+
+    /**
+     * @brief 映射offset开始的一段, 优先复用空闲的段结构, 失败返回nullptr
+     */
+    Segment* map(uint64_t offset);
+
+    /**
+     * @brief 段写满后映射下一段, 把跨段记录的剩余部分写到新段开头并发布,
+     *        剩余部分超过段大小时先写满中间的段. 映射失败时改为直接写文件
+     */
+    void roll(Segment* old, const char* tail, size_t tail_len);
+
+    /**
+     * @brief 映射失败后用pwrite写到文件末尾
+     */
+    bool writeDirect(const char* data, size_t len);
+private:
+    /// 文件描述符
+    int m_fd = -1;
+    /// 段大小
+    size_t m_segmentSize;
+    /// 当前段
+    std::atomic<Segment*> m_current{nullptr};
+    /// 所有段结构, 保留到析构, 晚到的写入可能仍在访问已退役段的inflight
+    std::vector<std::unique_ptr<Segment> > m_segments;
+    /// 已解除映射, 可复用的段结构
+    std::vector<Segment*> m_free;
+    /// 映射失败, 之后直接写文件
+    std::atomic<bool> m_direct{false};
+    /// 直接写文件时的数据末尾
+    std::atomic<uint64_t> m_end{0};
+    std::mutex m_mutex;
+};
+
+/**
+ * @brief 打开的日志文件
+ * @details 普通模式下用O_APPEND的文件描述符直接write, 内存映射模式下委托给MmapFileWriter.
+ *          通过shared_ptr发布, 最后一个引用释放时关闭文件
+ */
+class LogFile {
+public:
+    typedef std::shared_ptr<LogFile> ptr;
+
+    /**
+     * @brief 构造函数, 以追加方式打开文件
+     * @param[in] filename 文件名
+     * @param[in] segment_size 大于0时使用内存映射模式, 为段大小
+     */
+    LogFile(const std::string& filename, size_t segment_size = 0);
+
+    /**
+     * @brief 析构函数, 关闭文件
+     */
+    ~LogFile();
+
+    /**
+     * @brief 是否打开成功
+     */
+    bool isOpen() const { return m_fd >= 0 || (m_mmap && m_mmap->isOpen()); }
+
+    /**
+     * @brief 文件描述符, 内存映射模式下为-1
+     */
+    int getFd() const { return m_fd; }
+
+    /**
+     * @brief 打开时文件已有的长度
+     */
+    uint64_t getSize() const { return m_size; }
+
+    /**
+     * @brief 写入数据
+     */
+    bool write(const char* data, size_t len);
+
+    /**
+     * @brief 写入多段数据
+     */
+    bool writev(const struct iovec* iov, int iovcnt);
+private:
+    /// 文件描述符, 内存映射模式下为-1
+    int m_fd = -1;
+    /// 打开时的文件长度
+    uint64_t m_size = 0;
+    /// 内存映射模式的写入
+    MmapFileWriter::ptr m_mmap;
+};
+
 // Output file Appender  
 
-class FileLogAppender : public LogAppender {
+/**
+ * @brief 输出到文件的Appender, 支持按大小和按时间滚动
+ * @details 滚动由写日志的线程触发, 由后台线程完成: 把当前文件改名为
+ *          filename.YYYYmmdd-HHMMSS.NNN, 打开新的filename并原子地发布, 然后压缩归档
+ *          (需要SYLAR_HAVE_ZLIB)并删除超出保留数量的旧归档. 发布新文件前的写入
+ *          继续进入改名后的旧文件, 写日志的线程不会因滚动而阻塞
+ */
+class FileLogAppender : public LogAppender, public LogCrashFlushable {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
     void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+    bool acceptsFormatted() const override { return true; }
+    void write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) override;
      
-    FileLogAppender(const std::string& filename);
-    bool reopen() {}
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件名
+     * @param[in] segment_size 大于0时使用内存映射模式(MmapFileWriter), 为段大小
+     */
+    FileLogAppender(const std::string& filename, size_t segment_size = 0);
+
+    /**
+     * @brief 析构函数, 等待进行中的滚动完成
+     */
+    ~FileLogAppender();
+
+    /**
+     * @brief 重新打开文件(配合外部的logrotate使用), 新文件原子地替换旧文件
+     */
+    bool reopen();
+
+    /**
+     * @brief 设置滚动策略, 首次设置时启动后台线程
+     * @param[in] max_size 文件超过该长度时滚动, 0不按大小滚动
+     * @param[in] interval 按该间隔(秒, 按本地时间对齐)滚动, 0不按时间滚动
+     * @param[in] max_files 保留的归档数量, 0不限制
+     * @param[in] compress 是否gzip压缩归档
+     */
+    void setRotate(uint64_t max_size, uint32_t interval, uint32_t max_files = 0, bool compress = false);
+
+    /**
+     * @brief 请求滚动, 立即返回. 没有调用过setRotate时启动后台线程, 按默认策略(不压缩, 不清理)滚动
+     */
+    void rotate();
+
+    /**
+     * @brief 开启批量写出(在开始写日志前调用), 内存映射模式下写入本身没有系统调用, 忽略
+     * @param[in] max_bytes 累计达到该长度时写出
+     * @param[in] linger_ms 日志最长在缓冲中停留的毫秒数
+     */
+    void setBatch(size_t max_bytes = 64 * 1024, uint32_t linger_ms = 10);
+
+    /**
+     * @brief 写出批量缓冲中的日志
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时写出批量缓冲并追加崩溃记录, 内存映射模式下数据已在页缓存中, 不追加记录
+     */
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override;
+
+    LogMetrics::Snapshot getMetrics() const override;
+private:
+    /**
+     * @brief 后台线程
+     */
+    void run();
+
+    /**
+     * @brief 执行一次滚动, 在后台线程中不持锁调用
+     */
+    void doRotate(uint32_t interval, uint32_t max_files, bool compress);
+
+    /**
+     * @brief 删除超出保留数量的归档
+     */
+    void prune(uint32_t max_files);
+
+    /**
+     * @brief 计算下一次按时间滚动的时刻(微秒)
+     */
+    static uint64_t NextRotateTime(uint64_t now_us, uint32_t interval);
+private:
+    std::string m_filename;
+    /// 内存映射模式的段大小, 0为普通模式
+    size_t m_segmentSize;
+    /// 当前文件, 通过std::atomic_load/std::atomic_store访问
+    LogFile::ptr m_file;
+    /// 当前文件的描述符, 供信号处理函数使用
+    std::atomic<int> m_fd{-1};
+    /// 当前文件已写入的长度
+    std::atomic<uint64_t> m_size{0};
+    /// 按大小滚动的阈值
+    std::atomic<uint64_t> m_maxSize{0};
+    /// 按时间滚动的间隔(秒)
+    uint32_t m_interval = 0;
+    /// 保留的归档数量
+    uint32_t m_maxFiles = 0;
+    /// 是否压缩归档
+    bool m_compress = false;
+    /// 下一次按时间滚动的时刻(微秒), 0为不按时间滚动
+    std::atomic<uint64_t> m_nextRotate{0};
+    /// 已请求滚动, 尚未完成
+    std::atomic<bool> m_rotating{false};
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+    /// 批量写出
+    BatchLogWriter::ptr m_batch;
+};
+
+/**
+ * @brief 异步日志输出目标
+ * @details 调用线程只把日志事件放入有界无锁队列(只做一次入队),
+ *          由专门的后台线程批量取出, 依次写入被包装的Appender.
+ *          队列满时新日志被丢弃并计数, 不会阻塞调用线程.
+ */
+class AsyncLogAppender : public LogAppender, public LogCrashFlushable {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    /**
+     * @brief 构造函数, 启动后台写线程
+     * @param[in] capacity 队列容量(向上取整为2的幂)
+     * @param[in] batch 后台线程每批最多处理的日志数
+     */
+    AsyncLogAppender(size_t capacity = 8192, size_t batch = 256);
+
+    /**
+     * @brief 析构函数, 写完队列中剩余日志后停止后台线程
+     */
+    ~AsyncLogAppender();
+
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    /**
+     * @brief 添加被包装的Appender(由后台线程写入)
+     * @details 没有设置formatter的Appender使用本Appender的formatter
+     */
+    void addAppender(LogAppender::ptr appender);
+
+    /**
+     * @brief 删除被包装的Appender
+     */
+    void delAppender(LogAppender::ptr appender);
+
+    /**
+     * @brief 等待当前已入队的日志全部写出
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时在deadline前等待后台线程写完已入队的日志(后台线程自身崩溃时不等待)
+     */
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override;
+
+    /**
+     * @brief 返回因队列满而丢弃的日志数
+     */
+    uint64_t getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 返回统计快照, 包括队列长度和丢弃数
+     */
+    LogMetrics::Snapshot getMetrics() const override;
+private:
+    /**
+     * @brief 后台线程主循环
+     */
+    void run();
+
+    /**
+     * @brief 取出一批日志并写入被包装的Appender
+     * @return 本批写出的日志数
+     */
+    size_t drain();
+private:
+    /// 一条待写日志
+    struct Item {
+        std::shared_ptr<Logger> logger;
+        LogLevel::Level level;
+        LogEvent::ptr event;
+    };
+
+    /// 队列槽位, seq为Vyukov有界队列的序号
+    struct Cell {
+        std::atomic<size_t> seq;
+        Item item;
+    };
+
+    /// 队列槽位
+    std::unique_ptr<Cell[]> m_cells;
+    /// 容量掩码
+    size_t m_mask;
+    /// 每批最多处理数
+    size_t m_batch;
+    /// 生产者写位置
+    alignas(64) std::atomic<size_t> m_tail{0};
+    /// 消费者读位置
+    alignas(64) std::atomic<size_t> m_head{0};
+    /// 丢弃计数
+    std::atomic<uint64_t> m_dropped{0};
+    /// 后台线程是否在等待
+    std::atomic<bool> m_sleeping{false};
+    /// 是否停止
+    std::atomic<bool> m_stopping{false};
+    /// 后台线程的线程id
+    std::atomic<uint32_t> m_writerTid{0};
+    /// 后台线程当前批次, 复用避免每批分配
+    std::vector<Item> m_pending;
+    /// 被包装的Appender, 只在后台线程和增删时访问
+    std::list<LogAppender::ptr> m_appenders;
+    std::mutex m_appendersMutex;
+    /// 后台线程唤醒
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    /// 后台写线程
+    std::thread m_thread;
+};
+
+/**
+ * @brief 每线程一个SPSC字节环的文件Appender
+ * @details 调用线程(即宏取得GetThreadId()的线程)在本线程格式化日志, 写入自己独占的环,
+ *          生产者之间不共享任何缓存行. 后台线程轮询所有环, 按日志时间近似有序地合并,
+ *          直接从环内存writev写入文件. 线程退出后它的环在写完后回收. 环满时丢弃日志并计数
+ */
+class RingLogAppender : public LogAppender, public LogCrashFlushable {
+public:
+    typedef std::shared_ptr<RingLogAppender> ptr;
+
+    /**
+     * @brief 构造函数, 打开文件并启动后台写线程
+     * @param[in] filename 文件名
+     * @param[in] ring_size 每个线程的环大小(字节, 向上取整为2的幂)
+     */
+    RingLogAppender(const std::string& filename, size_t ring_size = 256 * 1024);
+
+    /**
+     * @brief 析构函数, 写完所有环中的日志后停止后台线程
+     */
+    ~RingLogAppender();
+
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+    bool acceptsFormatted() const override { return true; }
+    void write(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) override;
+
+    /**
+     * @brief 重新打开文件(配合外部的logrotate使用)
+     */
+    bool reopen();
+
+    /**
+     * @brief 等待当前已写入各环的日志全部写出
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时让后台线程停在两轮合并之间, 由调用线程合并写出各环剩余的日志并追加崩溃记录.
+     *        后台线程在deadline前没有停下(如卡在写入中)时不写出, 避免重复
+     */
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override;
+
+    /**
+     * @brief 返回因环满而丢弃的日志数
+     */
+    uint64_t getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 返回统计快照, 包括丢弃数
+     */
+    LogMetrics::Snapshot getMetrics() const override;
+private:
+    /**
+     * @brief 单生产者单消费者字节环
+     * @details 记录为8字节对齐的[长度, 时间, 内容], 放不下的尾部用WRAP标记跳过.
+     *          读写位置单调递增, 生产者缓存读位置, 只有环看起来满时才读取
+     */
+    class Ring {
+    public:
+        typedef std::shared_ptr<Ring> ptr;
+
+        /// 跳到环起点的标记
+        static const uint32_t WRAP = UINT32_MAX;
+
+        /**
+         * @brief 记录头
+         */
+        struct Header {
+            uint32_t len;
+            uint32_t reserved;
+            uint64_t time;
+        };
+
+        Ring(size_t size, uint64_t owner);
+
+        /**
+         * @brief 写入一条记录, 环满时返回false(生产者线程调用)
+         */
+        bool push(uint64_t time, const char* data, size_t len);
+
+        /**
+         * @brief 返回pos处的记录并把pos移到下一条(消费者线程调用, pos须小于写位置)
+         */
+        const Header* read(uint64_t& pos) const;
+
+        /// 写位置
+        alignas(64) std::atomic<uint64_t> tail{0};
+        /// 生产者缓存的读位置
+        uint64_t headCache = 0;
+        /// 读位置
+        alignas(64) std::atomic<uint64_t> head{0};
+        /// 所属线程已退出
+        std::atomic<bool> closed{false};
+        /// 所属Appender的序号
+        const uint64_t owner;
+    private:
+        std::unique_ptr<char[]> m_data;
+        size_t m_mask;
+    };
+
+    /**
+     * @brief 返回当前线程的环, 首次调用时创建并登记
+     */
+    Ring* getRing();
+
+    /**
+     * @brief 后台线程主循环
+     */
+    void run();
+
+    /**
+     * @brief 合并写出一轮各环中已有的日志, 回收已写完的退出线程的环
+     * @return 本轮写出的日志数
+     */
+    size_t drain();
+private:
+    std::string m_filename;
+    /// 每个环的大小
+    size_t m_ringSize;
+    /// 本Appender的序号, 区分线程本地缓存中不同Appender的环
+    uint64_t m_serial;
+    /// 当前文件, 通过std::atomic_load/std::atomic_store访问
+    LogFile::ptr m_file;
+    /// 当前文件的描述符, 供信号处理函数使用
+    std::atomic<int> m_fd{-1};
+    /// 已登记的环
+    std::vector<Ring::ptr> m_rings;
+    /// 登记的环有变化
+    std::atomic<bool> m_ringsChanged{false};
+    std::mutex m_ringsMutex;
+    /// 后台线程持有的环列表
+    std::vector<Ring::ptr> m_active;
+    /// 后台线程复用的合并堆(时间, 环下标), 各环的(读位置, 写位置)和iovec
+    std::vector<std::pair<uint64_t, size_t>> m_heap;
+    std::vector<std::pair<uint64_t, uint64_t>> m_cursors;
+    std::vector<struct iovec> m_iov;
+    /// 丢弃计数
+    std::atomic<uint64_t> m_dropped{0};
+    /// 后台线程是否在等待
+    std::atomic<bool> m_sleeping{false};
+    /// 是否停止
+    std::atomic<bool> m_stopping{false};
+    /// 崩溃写出进行中, 后台线程不再开始新一轮合并
+    std::atomic<bool> m_crashing{false};
+    /// 后台线程正在合并
+    std::atomic<bool> m_draining{false};
+    /// 后台线程的线程id
+    std::atomic<uint32_t> m_writerTid{0};
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+/**
+ * @brief 合并重复日志的Appender装饰器
+ * @details 按(调用点, 日志内容)的哈希把最近的日志分到slots个槽中, 同一槽内window_ms时间
+ *          窗口内内容完全相同的日志只写第一条, 重复串结束(窗口过期, 或槽被其他日志占用)时
+ *          由同一调用点写一条"last message repeated N times". 过期的重复串在之后任意一条
+ *          日志经过本Appender时汇总(每个窗口最多扫描一次槽), 没有后续日志时由flush()或
+ *          析构汇总. 被包装Appender的写出不持有本Appender的锁. 哈希是CRC32C, CPU支持时
+ *          用SSE4.2指令每次处理8字节
+ */
+class DedupLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<DedupLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] appender 被包装的Appender, 没有设置formatter时使用本Appender的formatter
+     * @param[in] window_ms 时间窗口(毫秒)
+     * @param[in] slots 槽数
+     */
+    DedupLogAppender(LogAppender::ptr appender, uint32_t window_ms = 1000, size_t slots = 64);
+
+    /**
+     * @brief 析构函数, 写出未结束的重复串的汇总
+     */
+    ~DedupLogAppender();
+
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    /**
+     * @brief 写出所有未结束的重复串的汇总
+     */
+    void flush();
+
+    /**
+     * @brief 返回被合并掉的日志数
+     */
+    uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 返回统计快照, 被合并掉的日志计入dropped
+     */
+    LogMetrics::Snapshot getMetrics() const override;
+private:
+    /**
+     * @brief 最近的一条日志和它的重复次数
+     */
+    struct Slot {
+        /// 哈希
+        uint32_t hash = 0;
+        /// 调用点, nullptr为空槽
+        const LogCallSite* site = nullptr;
+        /// 日志内容
+        std::string content;
+        /// 第一条的时间(微秒)
+        uint64_t time = 0;
+        /// 重复次数
+        uint64_t count = 0;
+        /// 日志器
+        std::shared_ptr<Logger> logger;
+        /// 日志级别
+        LogLevel::Level level = LogLevel::UNKNOW;
+    };
+
+    /**
+     * @brief 待写出的汇总
+     */
+    struct Summary {
+        std::shared_ptr<Logger> logger;
+        LogLevel::Level level;
+        LogEvent::ptr event;
+    };
+
+    /**
+     * @brief 重复串结束, 生成汇总放入out并清空计数
+     */
+    void summarize(Slot& slot, std::vector<Summary>& out);
+private:
+    /// 被包装的Appender
+    LogAppender::ptr m_appender;
+    /// 时间窗口(微秒)
+    uint64_t m_window;
+    std::vector<Slot> m_slots;
+    /// 下次扫描过期重复串的时间(微秒)
+    uint64_t m_nextSweep = 0;
+    /// 被合并掉的日志数
+    std::atomic<uint64_t> m_suppressed{0};
+    std::mutex m_mutex;
+};
+
+/**
+ * @brief 日志器管理类
+ * @details 日志器按名称分层, "net.http"的父日志器是"net", 顶层日志器的父日志器是root.
+ *          子日志器没有单独设置级别时继承父日志器的级别, 日志同时写入各级父日志器的Appender.
+ *          名称表是不可变快照, 查找不加锁; 创建日志器时复制一份再原子地发布
+ */
+class LoggerManager {
+public:
+    /**
+     * @brief 构造函数, 创建输出到标准输出的root日志器
+     */
+    LoggerManager();
+
+    /**
+     * @brief 析构函数
+     */
+    ~LoggerManager();
+
+    /**
+     * @brief 获取日志器, 不存在时创建(连同不存在的父日志器)
+     * @param[in] name 日志器名称, 以'.'分层
+     */
+    Logger::ptr getLogger(const std::string& name);
+
+    /**
+     * @brief 查找日志器, 不存在返回nullptr
+     */
+    Logger::ptr lookup(std::string_view name) const;
+
+    /**
+     * @brief 返回主日志器
+     */
+    const Logger::ptr& getRoot() const { return m_root; }
+private:
+    typedef std::map<std::string, Logger::ptr, std::less<> > LoggerMap;
+
+    /**
+     * @brief 在loggers中查找或创建name及其父日志器
+     */
+    Logger::ptr create(LoggerMap& loggers, std::string_view name);
+private:
+    /// 主日志器
+    Logger::ptr m_root;
+    /// 日志器快照
+    std::atomic<const LoggerMap*> m_loggers;
+    /// 串行化创建
+    std::mutex m_mutex;
+};
+
+/// 日志器管理类单例
+typedef sylar::Singleton<LoggerManager> LoggerMgr;
+
+/**
+ * @brief 二进制日志输出
+ * @details SYLAR_LOG_FMT_*的延迟格式化模式: 每条日志只写入调用点id, 日志器id,
+ *          时间, 线程/协程id和原始参数, vsnprintf和模板格式化由sylar-logdecode离线完成.
+ *          每个线程先把记录追加到自己的暂存区, 攒够STAGE_SIZE字节(或遇到FATAL)才加锁
+ *          交给共享缓冲区, 生产者之间不竞争同一把锁. 调用点, 日志器和线程名称的定义由
+ *          每个线程在首次引用时写入自己的暂存区(多个线程可能重复定义, 解码时后者覆盖前者).
+ *          flush(), reopen()和析构时取走所有线程的暂存区, 线程退出时交出自己的暂存区.
+ *
+ * 文件格式: 文件头"SYLARBL1", 之后是记录序列, 每条记录为
+ *          u32 长度(不含自身) | u8 类型 | 内容
+ */
+class BinaryLogWriter : public LogCrashFlushable {
+public:
+    typedef std::shared_ptr<BinaryLogWriter> ptr;
+
+    /// 文件头
+    static constexpr char MAGIC[8] = {'S', 'Y', 'L', 'A', 'R', 'B', 'L', '1'};
+    /// 线程暂存区超过该大小时交给共享缓冲区
+    static const size_t STAGE_SIZE = 4096;
+
+    /**
+     * @brief 记录类型
+     */
+    enum RecordType : uint8_t {
+        /// u32 id | u8 level | i32 line | u32 文件名长度 | 文件名 | 格式字符串
+        RECORD_SITE = 1,
+        /// u32 id | 日志器名称
+        RECORD_LOGGER = 2,
+        /// u32 线程id | 线程名称
+        RECORD_THREAD = 3,
+        /// u32 调用点id | u32 日志器id | u64 时间(微秒) | u32 线程id | u32 协程id | 参数
+        RECORD_EVENT = 4,
+        /// {}格式的调用点, 同RECORD_SITE
+        RECORD_BRACE_SITE = 5
+    };
+
+    /**
+     * @brief 参数类型, 每个参数为 u8 类型 | 值
+     */
+    enum ArgType : uint8_t {
+        /// i64
+        ARG_INT = 1,
+        /// u64
+        ARG_UINT = 2,
+        /// double
+        ARG_DOUBLE = 3,
+        /// u32 长度 | 字节
+        ARG_STRING = 4,
+        /// u64
+        ARG_POINTER = 5
+    };
+
+    /**
+     * @brief 构造函数, 打开文件(追加)
+     * @param[in] filename 文件名
+     * @param[in] buffer_size 缓冲区超过该大小时写入文件
+     */
+    BinaryLogWriter(const std::string& filename, size_t buffer_size = 64 * 1024);
+
+    /**
+     * @brief 析构函数, 写出缓冲区并关闭文件
+     */
+    ~BinaryLogWriter();
+
+    /**
+     * @brief 重新打开文件, 之后的定义记录重新写入
+     */
+    bool reopen();
+
+    /**
+     * @brief 写入一条日志
+     */
+    template<class... Args>
+    void write(const Logger& logger, const LogCallSite& site, uint32_t thread_id
+            , uint32_t fiber_id, const std::string& thread_name, const Args&... args);
+
+    /**
+     * @brief 把缓冲区写入文件
+     */
+    void flush();
+
+    /**
+     * @brief 崩溃时把缓冲区写入文件, 不追加崩溃记录
+     */
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override;
 private:
+    /**
+     * @brief 编码一个参数
+     */
+    template<class T>
+    static void EncodeArg(LogBuffer& buf, const T& v);
+
+    /**
+     * @brief 线程的暂存区
+     * @details 所有者线程在mutex下追加, flush/reopen/析构/崩溃写出时在mutex下取走.
+     *          加锁顺序为 m_stagesMutex -> Stage::mutex -> m_mutex
+     */
+    struct Stage {
+        typedef std::shared_ptr<Stage> ptr;
+
+        std::mutex mutex;
+        /// 待交出的记录
+        LogBuffer buffer;
+        /// 已在当前文件中定义的调用点/日志器, 按id索引
+        std::vector<bool> sites;
+        std::vector<bool> loggers;
+        /// 已写入当前文件的线程名称
+        std::string threadName;
+        bool threadDefined = false;
+        /// 所有者线程已退出
+        bool closed = false;
+        /// 所属的BinaryLogWriter, 析构后为nullptr
+        std::atomic<BinaryLogWriter*> writer{nullptr};
+        /// 所属BinaryLogWriter的id
+        uint64_t owner = 0;
+    };
+
+    /**
+     * @brief 返回当前线程在本writer的暂存区, 线程退出后返回nullptr
+     */
+    Stage* getStage();
+
+    /**
+     * @brief 把编码好的事件记录连同需要的定义记录追加到当前线程的暂存区
+     */
+    void commit(const Logger& logger, const LogCallSite& site
+            , const std::string& thread_name, uint32_t thread_id, const LogBuffer& record);
+
+    /**
+     * @brief 把记录和stage中尚未定义的调用点/日志器/线程名称追加到stage.buffer
+     */
+    static void StageRecord(Stage& stage, const Logger& logger, const LogCallSite& site
+            , const std::string& thread_name, uint32_t thread_id, const LogBuffer& record);
+
+    /**
+     * @brief 追加一条记录
+     */
+    static void AppendRecord(LogBuffer& buf, RecordType type, const char* data, size_t len);
+
+    /**
+     * @brief 把stage.buffer交给m_buffer, 需持有stage.mutex
+     * @param[in] write 是否随后写出m_buffer
+     */
+    void handoff(Stage& stage, bool write);
+
+    /**
+     * @brief 取走所有暂存区并写出, 去掉线程已退出的暂存区, 需持有m_stagesMutex
+     */
+    void drainStages();
+
+    /**
+     * @brief 写出m_buffer, 需持有m_mutex
+     */
+    void writeBuffer();
+private:
+    /// 文件名
     std::string m_filename;
-    std::ofstream m_filestream;
+    /// 文件描述符, 修改时持有所有暂存区的锁
+    int m_fd = -1;
+    /// 缓冲区写出阈值
+    size_t m_bufferSize;
+    /// 待写出的数据
+    LogBuffer m_buffer;
+    /// 进程内唯一的id, 用于查找线程的暂存区
+    uint64_t m_id;
+    /// 各线程的暂存区
+    std::vector<Stage::ptr> m_stages;
+    std::mutex m_stagesMutex;
+    std::mutex m_mutex;
+};
+
+/**
+ * @brief 二进制日志读取, 供sylar-logdecode使用
+ */
+class BinaryLogReader {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] filename 二进制日志文件
+     */
+    BinaryLogReader(const std::string& filename);
+
+    /**
+     * @brief 文件是否成功打开并且文件头正确
+     */
+    bool isValid() const { return m_valid; }
+
+    /**
+     * @brief 读取下一条日志, 定义记录在内部处理
+     * @param[out] event 日志事件, 内容已按格式字符串展开
+     * @return 文件结束或数据损坏时返回false
+     */
+    bool next(LogEvent::ptr& event);
+private:
+    /**
+     * @brief 按格式字符串和编码后的参数生成日志内容
+     * @param[in] brace fmt为{}格式, 否则为printf格式
+     */
+    static void FormatArgs(LogStream& os, const char* fmt, bool brace, const char* args, size_t len);
+private:
+    /// 调用点定义
+    struct Site {
+        LogLevel::Level level;
+        int32_t line;
+        std::string file;
+        std::string fmt;
+        bool brace;
+    };
+
+    /// 输入文件
+    std::ifstream m_in;
+    /// 文件头是否正确
+    bool m_valid = false;
+    /// 调用点定义, 按id索引
+    std::map<uint32_t, Site> m_sites;
+    /// 日志器, 按id索引
+    std::map<uint32_t, std::shared_ptr<Logger> > m_loggers;
+    /// 线程名称, 按线程id索引
+    std::map<uint32_t, std::string> m_threads;
+    /// 当前记录
+    std::string m_record;
+};
+
+/**
+ * @brief SYLAR_LOG_FMT_*的参数转换, std::string转为const char*
+ */
+template<class T>
+inline const T& LogFmtArg(const T& v) { return v; }
+inline const char* LogFmtArg(const std::string& v) { return v.c_str(); }
+
+/**
+ * @brief 宏参数是否为字符串字面量(decltype为const char(&)[N])
+ * @details 字符数组变量的decltype不是引用, 不会被当作字面量
+ */
+template<class T>
+struct LogIsLiteral : std::false_type {
+};
+
+template<size_t N>
+struct LogIsLiteral<const char(&)[N]> : std::true_type {
+};
+
+/**
+ * @brief printf格式串是否含%m(输出strerror(errno), 不消耗参数)
+ * @details 二进制记录在参数前写入errno, 供解码时还原%m
+ */
+constexpr bool LogPrintfUsesErrno(const char* fmt) {
+    for (size_t i = 0; fmt[i]; ++ i) {
+        if (fmt[i] != '%') {
+            continue;
+        }
+        ++ i;
+        // flags, width, precision and length before the conversion
+        while (fmt[i] && ((fmt[i] >= '0' && fmt[i] <= '9') || fmt[i] == '-' || fmt[i] == '+'
+                    || fmt[i] == ' ' || fmt[i] == '#' || fmt[i] == '\'' || fmt[i] == '*'
+                    || fmt[i] == '.' || fmt[i] == 'h' || fmt[i] == 'l' || fmt[i] == 'L'
+                    || fmt[i] == 'q' || fmt[i] == 'j' || fmt[i] == 'z' || fmt[i] == 't')) {
+            ++ i;
+        }
+        if (fmt[i] == 'm') {
+            return true;
+        }
+        if (!fmt[i]) {
+            break;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief {}格式串
+ * @details 每个{}按顺序替换为一个参数, {{和}}输出单个花括号, 不支持格式说明.
+ *          参数按类型直接写入日志内容: 整数, 浮点数(最短还原形式), bool(true/false),
+ *          char, 字符串, 指针(十六进制), 其他类型使用operator<<
+ */
+struct LogBraceFormat {
+    /**
+     * @brief 一段输出: arg<0时为fmt中[offset, offset+length)的字面量, 否则为第arg个参数
+     */
+    struct Op {
+        int arg;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    /**
+     * @brief 解析fmt
+     * @param[out] ops 输出, 为nullptr时只计数
+     * @param[out] args 参数个数
+     * @return 输出段数, 格式错误(单独的{或})返回-1
+     */
+    static constexpr int Compile(const char* fmt, Op* ops, int* args = nullptr) {
+        int count = 0;
+        int arg = 0;
+        uint32_t lit = 0;
+        uint32_t i = 0;
+        for (; fmt[i]; ++ i) {
+            char c = fmt[i];
+            if (c != '{' && c != '}') {
+                continue;
+            }
+            bool escaped = fmt[i + 1] == c;
+            if (!escaped && (c == '}' || fmt[i + 1] != '}')) {
+                return -1;
+            }
+            // an escaped brace keeps the first one in the literal
+            uint32_t end = escaped ? i + 1 : i;
+            if (end > lit) {
+                if (ops) {
+                    ops[count] = Op{-1, lit, end - lit};
+                }
+                ++ count;
+            }
+            if (!escaped) {
+                if (ops) {
+                    ops[count] = Op{arg, 0, 0};
+                }
+                ++ count;
+                ++ arg;
+            }
+            lit = i + 2;
+            ++ i;
+        }
+        if (i > lit) {
+            if (ops) {
+                ops[count] = Op{-1, lit, i - lit};
+            }
+            ++ count;
+        }
+        if (args) {
+            *args = arg;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 返回fmt中{}的个数, 格式错误返回-1
+     */
+    static constexpr int ArgCount(const char* fmt) {
+        int args = 0;
+        return Compile(fmt, nullptr, &args) < 0 ? -1 : args;
+    }
+};
+
+/**
+ * @brief 按{}格式的规则把一个参数写入os
+ */
+template<class T>
+void LogFormatArg(LogStream& os, const T& v);
+
+/**
+ * @brief SYLAR_LOG_FMT_*的实现
+ * @details logger设置了BinaryLogWriter, 调用点级别为常量且格式串为字面量时写二进制记录,
+ *          否则生成日志事件
+ * @tparam Errno 格式串含%m, 二进制记录需要写入errno
+ */
+template<bool Errno, class... Args>
+void LogFmt(const std::shared_ptr<Logger>& logger, const LogCallSite& site, LogLevel::Level level
+        , const char* fmt, uint32_t thread_id
+        , uint32_t fiber_id, const std::string& thread_name, const Args&... args);
+
+/**
+ * @brief SYLAR_LOG_BRACE_*的实现
+ * @details logger设置了BinaryLogWriter且调用点级别为常量时写二进制记录, 否则生成日志事件;
+ *          参数中有不能写入二进制记录的类型(使用operator<<输出的类型)时也生成日志事件.
+ *          fmt为返回格式串的无捕获lambda, 以便在编译期取得格式串
+ */
+template<class F, class... Args>
+void LogBraceFmt(const std::shared_ptr<Logger>& logger, const LogCallSite& site, LogLevel::Level level
+        , F fmt, uint32_t thread_id
+        , uint32_t fiber_id, const std::string& thread_name, const Args&... args);
+
+template<LogFormatter::OpCode C>
+inline void LogFormatter::ExecuteOp(LogBuffer& buf, const char* arg, uint32_t len
+        , const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+    if constexpr (C == OP_LITERAL) {
+        buf.append(arg, len);
+    } else if constexpr (C == OP_MESSAGE) {
+        std::string_view content = event.getContentView();
+        if (len == 0) {
+            buf.append(content.data(), content.size());
+        } else {
+            AppendEscaped(buf, content.data(), content.size()
+                    , arg[0] == 'j' ? ESCAPE_JSON : arg[0] == 't' ? ESCAPE_TEXT : ESCAPE_NONE);
+        }
+    } else if constexpr (C == OP_LEVEL) {
+        buf.append(LogLevel::ToString(level));
+    } else if constexpr (C == OP_ELAPSE) {
+        buf.appendUInt(event.getElapse());
+    } else if constexpr (C == OP_NAME) {
+        buf.append(logger.getName());
+    } else if constexpr (C == OP_THREAD_ID) {
+        AppendThreadId(buf, event.getThreadId());
+    } else if constexpr (C == OP_NEWLINE) {
+        buf.append('\n');
+    } else if constexpr (C == OP_DATETIME) {
+        FormatTime(buf, arg, len, event.getTimeUS());
+    } else if constexpr (C == OP_FILENAME) {
+        buf.append(event.getFile());
+    } else if constexpr (C == OP_LINE) {
+        buf.appendInt(event.getLine());
+    } else if constexpr (C == OP_TAB) {
+        buf.append('\t');
+    } else if constexpr (C == OP_FIBER_ID) {
+        buf.appendUInt(event.getFiberId());
+    } else if constexpr (C == OP_THREAD_NAME) {
+        buf.append(event.getThreadName());
+    } else if constexpr (C == OP_FIELDS) {
+        event.getFields().format(buf);
+    }
+}
+
+constexpr int LogFormatter::Compile(const char* pattern, Op* ops) {
+    size_t size = 0;
+    while (pattern[size]) {
+        ++ size;
+    }
+    int count = 0;
+    size_t lit = 0;
+    for (size_t i = 0; i < size; ++ i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+        if (i > lit) {
+            if (ops) {
+                ops[count] = Op{OP_LITERAL, (uint32_t)lit, (uint32_t)(i - lit)};
+            }
+            ++ count;
+        }
+        if (i + 1 < size && pattern[i + 1] == '%') {
+            // the second '%' starts the next literal
+            lit = ++ i;
+            continue;
+        }
+        size_t n = i + 1;
+        int fmt_status = 0;
+        size_t key_end = 0;
+        size_t fmt_begin = 0;
+        size_t fmt_end = 0;
+        while (n < size) {
+            char c = pattern[n];
+            if (fmt_status == 0) {
+                if (c == '{') {
+                    key_end = n;
+                    fmt_begin = n + 1;
+                    fmt_status = 1;
+                    ++ n;
+                    continue;
+                }
+                if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+                    break;
+                }
+            } else if (c == '}') {
+                fmt_end = n;
+                fmt_status = 2;
+                ++ n;
+                break;
+            }
+            ++ n;
+        }
+        if (fmt_status == 1) {
+            return -1;
+        }
+        if (fmt_status == 0) {
+            key_end = fmt_begin = fmt_end = n;
+        }
+        if (key_end != i + 2) {
+            return -1;
+        }
+        OpCode code = OP_LITERAL;
+        switch (pattern[i + 1]) {
+#define XX(str, C) \
+            case str: code = C; break;
+
+            XX('m', OP_MESSAGE);
+            XX('p', OP_LEVEL);
+            XX('r', OP_ELAPSE);
+            XX('c', OP_NAME);
+            XX('t', OP_THREAD_ID);
+            XX('n', OP_NEWLINE);
+            XX('d', OP_DATETIME);
+            XX('f', OP_FILENAME);
+            XX('l', OP_LINE);
+            XX('T', OP_TAB);
+            XX('F', OP_FIBER_ID);
+            XX('N', OP_THREAD_NAME);
+            XX('K', OP_FIELDS);
+#undef XX
+            default:
+                return -1;
+        }
+        if (ops) {
+            ops[count] = Op{code, (uint32_t)fmt_begin, (uint32_t)(fmt_end - fmt_begin)};
+        }
+        ++ count;
+        lit = n;
+        i = n - 1;
+    }
+    if (size > lit) {
+        if (ops) {
+            ops[count] = Op{OP_LITERAL, (uint32_t)lit, (uint32_t)(size - lit)};
+        }
+        ++ count;
+    }
+    return count;
+}
+
+/**
+ * @brief 编译期解析Pattern得到的指令序列
+ */
+template<const char* Pattern, size_t N>
+constexpr std::array<LogFormatter::Op, N> CompileLogPattern() {
+    std::array<LogFormatter::Op, N> ops{};
+    LogFormatter::Compile(Pattern, ops.data());
+    return ops;
+}
+
+/**
+ * @brief 模板在编译期解析的日志格式器
+ * @details Pattern须为constexpr字符数组, 模板有错误时编译失败;
+ *          每个字段展开成一次内联写入, 没有解析和分派开销.
+ *          一般通过SYLAR_STATIC_LOG_FORMATTER(pattern)创建
+ */
+template<const char* Pattern>
+class StaticLogFormatter : public LogFormatter {
+public:
+    typedef std::shared_ptr<StaticLogFormatter> ptr;
+
+    StaticLogFormatter()
+        :LogFormatter(Pattern) {
+    }
+
+    using LogFormatter::format;
+
+    void format(LogBuffer& buf, const Logger& logger, LogLevel::Level level, const LogEvent& event) const override {
+        execute(buf, logger, level, event, std::make_index_sequence<s_count>());
+    }
+private:
+    template<size_t... I>
+    static void execute(LogBuffer& buf, const Logger& logger, LogLevel::Level level
+            , const LogEvent& event, std::index_sequence<I...>) {
+        (ExecuteOp<s_ops[I].code>(buf, Pattern + s_ops[I].offset, s_ops[I].length
+                                  , logger, level, event), ...);
+    }
+private:
+    /// 指令数
+    static constexpr int s_count = Compile(Pattern, nullptr);
+    static_assert(s_count >= 0, "sylar::StaticLogFormatter: log pattern parse error");
+    /// 指令序列
+    static constexpr std::array<Op, (s_count > 0 ? s_count : 0)> s_ops
+        = CompileLogPattern<Pattern, (s_count > 0 ? s_count : 0)>();
 };
 
+template<class T>
+inline void BinaryLogWriter::EncodeArg(LogBuffer& buf, const T& v) {
+    if constexpr (std::is_floating_point<T>::value) {
+        double d = v;
+        buf.append((char)ARG_DOUBLE);
+        buf.append((const char*)&d, sizeof(d));
+    } else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+        if constexpr (std::is_enum<T>::value || std::is_signed<T>::value) {
+            int64_t i = (int64_t)v;
+            buf.append((char)ARG_INT);
+            buf.append((const char*)&i, sizeof(i));
+        } else {
+            uint64_t u = v;
+            buf.append((char)ARG_UINT);
+            buf.append((const char*)&u, sizeof(u));
+        }
+    } else if constexpr (std::is_same<T, std::string_view>::value) {
+        uint32_t len = v.size();
+        buf.append((char)ARG_STRING);
+        buf.append((const char*)&len, sizeof(len));
+        buf.append(v.data(), len);
+    } else if constexpr (std::is_convertible<T, const char*>::value
+            || std::is_same<T, std::string>::value) {
+        const char* str;
+        if constexpr (std::is_same<T, std::string>::value) {
+            str = v.c_str();
+        } else if constexpr (std::is_array<T>::value) {
+            str = v;
+        } else {
+            str = v ? (const char*)v : "(null)";
+        }
+        uint32_t len = strlen(str);
+        buf.append((char)ARG_STRING);
+        buf.append((const char*)&len, sizeof(len));
+        buf.append(str, len);
+    } else {
+        static_assert(std::is_pointer<T>::value || std::is_null_pointer<T>::value
+                , "SYLAR_LOG_FMT_*: argument type is not printf compatible");
+        uint64_t p = (uint64_t)(uintptr_t)v;
+        buf.append((char)ARG_POINTER);
+        buf.append((const char*)&p, sizeof(p));
+    }
+}
+
+template<class... Args>
+void BinaryLogWriter::write(const Logger& logger, const LogCallSite& site, uint32_t thread_id
+        , uint32_t fiber_id, const std::string& thread_name, const Args&... args) {
+    std::unique_ptr<LogBuffer> own;
+    LogBuffer& t_record = LogThreadLocal<LogBuffer, 3>::Get(own);
+    t_record.clear();
+    uint32_t logger_id = logger.getId();
+    uint64_t time = GetLogTimeUS();
+    uint32_t site_id = site.getId();
+    t_record.append((const char*)&site_id, sizeof(site_id));
+    t_record.append((const char*)&logger_id, sizeof(logger_id));
+    t_record.append((const char*)&time, sizeof(time));
+    t_record.append((const char*)&thread_id, sizeof(thread_id));
+    t_record.append((const char*)&fiber_id, sizeof(fiber_id));
+    (EncodeArg(t_record, args), ...);
+    commit(logger, site, thread_name, thread_id, t_record);
+}
+
+template<class T>
+inline void LogFormatArg(LogStream& os, const T& v) {
+    LogStreamBuf& buf = os.buffer();
+    if constexpr (std::is_same<T, bool>::value) {
+        os.write(v ? "true" : "false", v ? 4 : 5);
+    } else if constexpr (std::is_same<T, char>::value) {
+        *buf.prepare(1) = v;
+        buf.commit(1);
+    } else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+        if constexpr (std::is_enum<T>::value || std::is_signed<T>::value) {
+            int64_t i = (int64_t)v;
+            char* p = buf.prepare(21);
+            *p = '-';
+            buf.commit((i < 0) + LogBuffer::FormatUInt(p + (i < 0), i < 0 ? -(uint64_t)i : i));
+        } else {
+            buf.commit(LogBuffer::FormatUInt(buf.prepare(20), v));
+        }
+    } else if constexpr (std::is_floating_point<T>::value) {
+        char* p = buf.prepare(48);
+        buf.commit(std::to_chars(p, p + 48, v).ptr - p);
+    } else if constexpr (std::is_convertible<const T&, const char*>::value) {
+        const char* str = v;
+        if (!str) {
+            str = "(null)";
+        }
+        os.write(str, strlen(str));
+    } else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+        std::string_view str(v);
+        os.write(str.data(), str.size());
+    } else if constexpr (std::is_pointer<T>::value || std::is_null_pointer<T>::value) {
+        uintptr_t u = (uintptr_t)v;
+        char* p = buf.prepare(18);
+        size_t len = 3;
+        while (len < 18 && (u >> ((len - 2) * 4))) {
+            ++ len;
+        }
+        p[0] = '0';
+        p[1] = 'x';
+        for (size_t i = len; i > 2; -- i, u >>= 4) {
+            p[i - 1] = "0123456789abcdef"[u & 0xf];
+        }
+        buf.commit(len);
+    } else {
+        os << v;
+    }
+}
+
+/**
+ * @brief {}格式的二进制记录参数转换, bool和char转为字符串, 与文本输出一致
+ */
+template<class T>
+inline const T& LogBraceBinaryArg(const T& v) { return v; }
+inline const char* LogBraceBinaryArg(bool v) { return v ? "true" : "false"; }
+inline std::string_view LogBraceBinaryArg(const char& v) { return std::string_view(&v, 1); }
+
+/**
+ * @brief 参数类型能否写入二进制记录
+ */
+template<class T>
+struct LogBinaryEncodable : std::integral_constant<bool, std::is_arithmetic<T>::value
+        || std::is_enum<T>::value || std::is_pointer<T>::value || std::is_null_pointer<T>::value
+        || std::is_convertible<const T&, const char*>::value || std::is_same<T, std::string>::value
+        || std::is_same<T, std::string_view>::value> {
+};
+
+/**
+ * @brief 按编译期解析的指令输出一段
+ */
+template<int Arg, class... Args>
+inline void LogBraceOp(LogStream& os, const char* lit, uint32_t len, const Args&... args) {
+    if constexpr (Arg < 0) {
+        os.write(lit, len);
+    } else {
+        LogFormatArg(os, std::get<Arg>(std::forward_as_tuple(args...)));
+    }
+}
+
+template<class F, size_t... I, class... Args>
+inline void LogBraceWrite(LogStream& os, F fmt, std::index_sequence<I...>, const Args&... args) {
+    constexpr const char* f = fmt();
+    constexpr std::array<LogBraceFormat::Op, sizeof...(I)> ops = [f]() {
+        std::array<LogBraceFormat::Op, sizeof...(I)> ops{};
+        LogBraceFormat::Compile(f, ops.data());
+        return ops;
+    }();
+    (LogBraceOp<ops[I].arg>(os, f + ops[I].offset, ops[I].length, args...), ...);
+}
+
+template<bool Errno, class... Args>
+void LogFmt(const std::shared_ptr<Logger>& logger, const LogCallSite& site, LogLevel::Level level
+        , const char* fmt, uint32_t thread_id
+        , uint32_t fiber_id, const std::string& thread_name, const Args&... args) {
+    // the binary definition record carries the site level and format, so
+    // runtime-level sites and non-literal formats always go through a log event
+    if (site.info.fmt && site.info.level != LogLevel::UNKNOW) {
+        if (BinaryLogWriter* writer = logger->getBinaryWriter()) {
+            if constexpr (Errno) {
+                int err = errno;
+                writer->write(*logger, site, thread_id, fiber_id, thread_name, err, args...);
+            } else {
+                writer->write(*logger, site, thread_id, fiber_id, thread_name, args...);
+            }
+            return;
+        }
+    }
+    LogEventWrap(LogEventPool::Acquire(logger, site, level, 0
+                , thread_id, fiber_id, GetLogTimeUS(), thread_name))
+        .getEvent()->format(fmt, LogFmtArg(args)...);
+}
+
+template<class F, class... Args>
+void LogBraceFmt(const std::shared_ptr<Logger>& logger, const LogCallSite& site, LogLevel::Level level
+        , F fmt, uint32_t thread_id
+        , uint32_t fiber_id, const std::string& thread_name, const Args&... args) {
+    constexpr const char* f = fmt();
+    static_assert(LogBraceFormat::ArgCount(f) >= 0
+            , "SYLAR_LOG_BRACE_*: unmatched '{' or '}' in format string");
+    static_assert(LogBraceFormat::ArgCount(f) == (int)sizeof...(Args)
+            , "SYLAR_LOG_BRACE_*: number of {} does not match the number of arguments");
+    if constexpr ((LogBinaryEncodable<Args>::value && ...)) {
+        if (site.info.level != LogLevel::UNKNOW) {
+            if (BinaryLogWriter* writer = logger->getBinaryWriter()) {
+                writer->write(*logger, site, thread_id, fiber_id, thread_name, LogBraceBinaryArg(args)...);
+                return;
+            }
+        }
+    }
+    LogEventWrap wrap(LogEventPool::Acquire(logger, site, level, 0
+                , thread_id, fiber_id, GetLogTimeUS(), thread_name));
+    constexpr int count = LogBraceFormat::Compile(f, nullptr);
+    LogBraceWrite(wrap.getSS(), fmt, std::make_index_sequence<(count > 0 ? count : 0)>(), args...);
+}
+
 }
 
 #endif
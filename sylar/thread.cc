@@ -0,0 +1,26 @@
+#include "thread.h"
+
+namespace sylar {
+
+// trivially destructible, still readable after the name is destroyed at thread exit
+static thread_local bool t_thread_name_dead = false;
+
+static thread_local struct ThreadName {
+    std::string name = "UNKNOW";
+    ~ThreadName() { t_thread_name_dead = true; }
+} t_thread_name;
+
+const std::string& Thread::GetName() {
+    // logging from a thread_local destructor that runs after ours
+    static const std::string s_unknown = "UNKNOW";
+    return t_thread_name_dead ? s_unknown : t_thread_name.name;
+}
+
+void Thread::SetName(const std::string& name) {
+    if (name.empty() || t_thread_name_dead) {
+        return;
+    }
+    t_thread_name.name = name;
+}
+
+}
@@ -0,0 +1,31 @@
+/**
+ * @file thread.h
+ * @brief 线程相关的封装
+ */
+#ifndef SYLAR_THREAD_H
+#define SYLAR_THREAD_H
+
+#include <string>
+
+namespace sylar {
+
+/**
+ * @brief 线程类
+ */
+class Thread {
+public:
+    /**
+     * @brief 获取当前的线程名称
+     */
+    static const std::string& GetName();
+
+    /**
+     * @brief 设置当前线程名称
+     * @param[in] name 线程名称
+     */
+    static void SetName(const std::string& name);
+};
+
+}
+
+#endif
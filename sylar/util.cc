@@ -0,0 +1,29 @@
+#include "util.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace sylar {
+
+// 0 until the first call on each thread
+static thread_local uint32_t t_thread_id = 0;
+
+static void ResetThreadId() {
+    t_thread_id = 0;
+}
+
+// the child of fork() keeps the parent thread's cached id
+static int s_thread_id_atfork = pthread_atfork(nullptr, nullptr, ResetThreadId);
+
+uint32_t GetThreadId() {
+    if (!t_thread_id) {
+        t_thread_id = syscall(SYS_gettid);
+    }
+    return t_thread_id;
+}
+
+uint32_t GetFiberId() {
+    return 0;
+}
+
+}
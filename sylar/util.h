@@ -0,0 +1,25 @@
+/**
+ * @file util.h
+ * @brief 常用的工具函数
+ */
+#ifndef SYLAR_UTIL_H
+#define SYLAR_UTIL_H
+
+#include <stdint.h>
+
+namespace sylar {
+
+/**
+ * @brief 返回当前线程的ID
+ * @details 每个线程第一次调用时执行gettid系统调用, 之后返回缓存在thread_local中的值
+ */
+uint32_t GetThreadId();
+
+/**
+ * @brief 返回当前协程的ID, 没有协程时返回0
+ */
+uint32_t GetFiberId();
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * @file test_log_alloc.cc
+ * @brief 稳定运行时写日志不分配内存, 以及事件池不延长logger的生命周期
+ */
+#include "sylar/log.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+// operator new is replaced below, gcc flags its free() as mismatched
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static std::atomic<bool> s_counting{false};
+static std::atomic<uint64_t> s_allocs{0};
+
+void* operator new(size_t size) {
+    if (s_counting.load(std::memory_order_relaxed)) {
+        s_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+static void LogSome(sylar::Logger::ptr logger, int n) {
+    for (int i = 0; i < n; ++ i) {
+        SYLAR_LOG_INFO(logger) << "steady state " << i << ' ' << 3.5;
+        SYLAR_LOG_FMT_INFO(logger, "fmt %d %s", i, "text");
+        SYLAR_LOG_BRACE_INFO(logger, "brace {} {}", i, "text");
+    }
+}
+
+static int TestSteadyState(const std::string& path) {
+    sylar::Logger::ptr logger(new sylar::Logger("alloc"));
+    logger->addAppender(std::make_shared<sylar::FileLogAppender>(path));
+    // fills the event pool and the thread local buffers
+    LogSome(logger, 1000);
+
+    s_allocs.store(0);
+    s_counting.store(true);
+    LogSome(logger, 10000);
+    s_counting.store(false);
+    uint64_t allocs = s_allocs.load();
+    if (allocs) {
+        fprintf(stderr, "%llu allocations in 30000 log calls\n", (unsigned long long)allocs);
+    }
+    CHECK(allocs == 0);
+    return 0;
+}
+
+static int TestLoggerLifetime(const std::string& path) {
+    sylar::Logger::ptr logger(new sylar::Logger("lifetime"));
+    logger->addAppender(std::make_shared<sylar::FileLogAppender>(path));
+    std::weak_ptr<sylar::Logger> weak = logger;
+    LogSome(logger, 10);
+    logger.reset();
+    // idle pooled events must not keep the logger and its appenders alive
+    CHECK(weak.expired());
+
+    sylar::Logger::ptr async_logger(new sylar::Logger("lifetime.async"));
+    auto async = std::make_shared<sylar::AsyncLogAppender>();
+    async->addAppender(std::make_shared<sylar::FileLogAppender>(path));
+    async_logger->addAppender(async);
+    weak = async_logger;
+    LogSome(async_logger, 10);
+    async->flush();
+    async_logger.reset();
+    async.reset();
+    CHECK(weak.expired());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char path[] = "/tmp/sylar_test_log_alloc.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    int rt = TestSteadyState(path);
+    if (rt == 0) {
+        rt = TestLoggerLifetime(path);
+    }
+    unlink(path);
+    if (rt == 0) {
+        printf("test_log_alloc passed\n");
+    }
+    return rt;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file test_log_binary.cc
+ * @brief BinaryLogWriter多线程写入和解码
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+static const int s_threads = 4;
+static const int s_lines = 5000;
+
+int main(int argc, char** argv) {
+    char path[] = "/tmp/sylar_test_log_binary.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    unlink(path);
+    {
+        sylar::Logger::ptr logger(new sylar::Logger("binary"));
+        auto writer = std::make_shared<sylar::BinaryLogWriter>(path);
+        logger->setBinaryWriter(writer);
+        // threads exit before flush(), their stages are handed over on exit
+        std::vector<std::thread> threads;
+        for (int t = 0; t < s_threads; ++ t) {
+            threads.emplace_back([logger, t]() {
+                for (int i = 0; i < s_lines; ++ i) {
+                    SYLAR_LOG_FMT_INFO(logger, "thread %d line %d", t, i);
+                }
+            });
+        }
+        for (auto& i : threads) {
+            i.join();
+        }
+        SYLAR_LOG_FMT_INFO(logger, "main %s", "done");
+        writer->flush();
+    }
+
+    sylar::BinaryLogReader reader(path);
+    CHECK(reader.isValid());
+    std::set<std::string> lines;
+    size_t count = 0;
+    sylar::LogEvent::ptr event;
+    while (reader.next(event)) {
+        lines.insert(event->getContent());
+        ++ count;
+    }
+    unlink(path);
+    CHECK(count == s_threads * s_lines + 1);
+    CHECK(lines.size() == count);
+    CHECK(lines.count("thread 3 line 4999"));
+    CHECK(lines.count("main done"));
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file test_log_crash.cc
+ * @brief LogCrashHandler::Unregister等待正在进行的Flush
+ */
+#include "sylar/log.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+/**
+ * @brief crashFlush耗时较长的登记对象
+ */
+class SlowFlushable : public sylar::LogCrashFlushable {
+public:
+    void crashFlush(uint64_t deadline, const char* record, size_t len) override {
+        m_entered.store(true);
+        usleep(50 * 1000);
+        m_finished.store(true);
+    }
+
+    std::atomic<bool> m_entered{false};
+    std::atomic<bool> m_finished{false};
+};
+
+int main(int argc, char** argv) {
+    SlowFlushable flushable;
+    CHECK(sylar::LogCrashHandler::Register(&flushable, sylar::LogCrashFlushable::BUFFER));
+    std::thread flusher([]() {
+        sylar::LogCrashHandler::Flush();
+    });
+    while (!flushable.m_entered.load()) {
+        sched_yield();
+    }
+    sylar::LogCrashHandler::Unregister(&flushable);
+    bool finished = flushable.m_finished.load();
+    flusher.join();
+    CHECK(finished);
+
+    // unregistered objects are not flushed any more
+    flushable.m_entered.store(false);
+    sylar::LogCrashHandler::Flush();
+    CHECK(!flushable.m_entered.load());
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file test_log_dedup.cc
+ * @brief DedupLogAppender过期汇总
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+/**
+ * @brief 记录收到的日志内容
+ */
+class CaptureAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        m_contents.push_back(event->getContent());
+    }
+
+    std::vector<std::string> m_contents;
+};
+
+int main(int argc, char** argv) {
+    sylar::Logger::ptr logger(new sylar::Logger("dedup"));
+    auto capture = std::make_shared<CaptureAppender>();
+    auto dedup = std::make_shared<sylar::DedupLogAppender>(capture, 50);
+    logger->addAppender(dedup);
+    for (int i = 0; i < 3; ++ i) {
+        SYLAR_LOG_INFO(logger) << "repeated";
+    }
+    CHECK(capture->m_contents.size() == 1);
+    CHECK(dedup->getSuppressed() == 2);
+
+    // the repeated slot is never hit again, a later unrelated log expires it
+    usleep(60 * 1000);
+    SYLAR_LOG_INFO(logger) << "other";
+    bool summarized = false;
+    for (auto& i : capture->m_contents) {
+        summarized |= i == "last message repeated 2 times";
+    }
+    CHECK(summarized);
+    CHECK(capture->m_contents.back() == "other");
+    printf("ok\n");
+    return 0;
+}
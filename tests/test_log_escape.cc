@@ -0,0 +1,109 @@
+/**
+ * @file test_log_escape.cc
+ * @brief 转义字节查找(逐字节/SSE2/AVX2)和AppendEscaped与逐字节参考实现对比
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <string>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+static bool NeedsEscape(unsigned char c, sylar::LogFormatter::Escape mode) {
+    if (c < 0x20) {
+        return true;
+    }
+    if (mode == sylar::LogFormatter::ESCAPE_JSON) {
+        return c == '"' || c == '\\';
+    }
+    return c == 0x7f;
+}
+
+static size_t RefFind(const std::string& str, sylar::LogFormatter::Escape mode) {
+    for (size_t i = 0; i < str.size(); ++ i) {
+        if (NeedsEscape(str[i], mode)) {
+            return i;
+        }
+    }
+    return str.size();
+}
+
+static std::string RefEscape(const std::string& str, sylar::LogFormatter::Escape mode) {
+    static const char* s_hex = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : str) {
+        if (!NeedsEscape(c, mode)) {
+            out += c;
+        } else if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else {
+            out += mode == sylar::LogFormatter::ESCAPE_JSON ? "\\u00" : "\\x";
+            out += s_hex[c >> 4];
+            out += s_hex[c & 0xf];
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief 所有实现和AppendEscaped都与参考实现一致
+ */
+static bool Compare(const std::string& str, sylar::LogFormatter::Escape mode) {
+    static const sylar::LogFormatter::EscapeScanner s_scanners[] = {
+        sylar::LogFormatter::SCAN_AUTO, sylar::LogFormatter::SCAN_SCALAR
+        , sylar::LogFormatter::SCAN_SSE2, sylar::LogFormatter::SCAN_AVX2};
+    size_t expect = RefFind(str, mode);
+    for (auto scanner : s_scanners) {
+        if (sylar::LogFormatter::FindEscape(str.data(), str.size(), mode, scanner) != expect) {
+            fprintf(stderr, "scanner %d mode %d len %zu: expected %zu\n"
+                    , scanner, mode, str.size(), expect);
+            return false;
+        }
+    }
+    sylar::LogBuffer buf;
+    sylar::LogFormatter::AppendEscaped(buf, str.data(), str.size(), mode);
+    return std::string(buf.data(), buf.size()) == RefEscape(str, mode);
+}
+
+int main(int argc, char** argv) {
+    const sylar::LogFormatter::Escape modes[] = {sylar::LogFormatter::ESCAPE_TEXT
+        , sylar::LogFormatter::ESCAPE_JSON};
+    // 0x7e, 0x80 and 0xff neighbour the escaped ranges and catch signed compares
+    const unsigned char fillers[] = {'a', 0x7e, 0x80, 0xff};
+    for (auto mode : modes) {
+        for (size_t len = 0; len <= 70; ++ len) {
+            for (unsigned char filler : fillers) {
+                std::string str(len, (char)filler);
+                CHECK(Compare(str, mode));
+                // every byte value at every position
+                for (size_t pos = 0; pos < len; ++ pos) {
+                    for (int c = 0; c < 256; ++ c) {
+                        str[pos] = (char)c;
+                        CHECK(Compare(str, mode));
+                    }
+                    str[pos] = (char)filler;
+                }
+            }
+            // all high bytes, then a trailing escape past the first vector
+            std::string high;
+            for (size_t i = 0; i < len; ++ i) {
+                high += (char)(0x80 + i % 0x80);
+            }
+            CHECK(Compare(high, mode));
+            CHECK(Compare(high + "\x7f", mode));
+            CHECK(Compare(high + "\"", mode));
+        }
+    }
+    printf("ok\n");
+    return 0;
+}
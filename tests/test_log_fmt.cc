@@ -0,0 +1,82 @@
+/**
+ * @file test_log_fmt.cc
+ * @brief SYLAR_LOG_FMT_*(printf格式)和SYLAR_LOG_BRACE_*({}格式)
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+/**
+ * @brief 记录收到的日志内容
+ */
+class CaptureAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        m_contents.push_back(event->getContent());
+    }
+
+    std::vector<std::string> m_contents;
+};
+
+static const char* s_fmt = "runtime %d %s";
+
+int main(int argc, char** argv) {
+    sylar::Logger::ptr logger(new sylar::Logger("fmt"));
+    auto capture = std::make_shared<CaptureAppender>();
+    logger->addAppender(capture);
+
+    // printf with a non-literal format, "{}" is printed as is
+    std::string local = "local %s";
+    SYLAR_LOG_FMT_INFO(logger, s_fmt, 1, "x");
+    SYLAR_LOG_FMT_INFO(logger, local.c_str(), std::string("y"));
+    SYLAR_LOG_FMT_INFO(logger, "%s {} literal", "a");
+    SYLAR_LOG_BRACE_INFO(logger, "{} + {} = {} {{}}", 1, 2.5, "x");
+    CHECK(capture->m_contents.size() == 4);
+    CHECK(capture->m_contents[0] == "runtime 1 x");
+    CHECK(capture->m_contents[1] == "local y");
+    CHECK(capture->m_contents[2] == "a {} literal");
+    CHECK(capture->m_contents[3] == "1 + 2.5 = x {}");
+
+    // binary records keep the two formats apart, a non-literal format goes to the appenders
+    char path[] = "/tmp/sylar_test_log_fmt.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    unlink(path);
+    capture->m_contents.clear();
+    {
+        auto writer = std::make_shared<sylar::BinaryLogWriter>(path);
+        logger->setBinaryWriter(writer);
+        SYLAR_LOG_FMT_INFO(logger, "%s {} literal", "b");
+        SYLAR_LOG_BRACE_INFO(logger, "{} {}", 7, "z");
+        SYLAR_LOG_FMT_INFO(logger, s_fmt, 2, "w");
+        writer->flush();
+        logger->setBinaryWriter(nullptr);
+    }
+    CHECK(capture->m_contents.size() == 1);
+    CHECK(capture->m_contents[0] == "runtime 2 w");
+
+    sylar::BinaryLogReader reader(path);
+    CHECK(reader.isValid());
+    std::vector<std::string> lines;
+    sylar::LogEvent::ptr event;
+    while (reader.next(event)) {
+        lines.push_back(event->getContent());
+    }
+    unlink(path);
+    CHECK(lines.size() == 2);
+    CHECK(lines[0] == "b {} literal");
+    CHECK(lines[1] == "7 z");
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_log_level.cc
+ * @brief SYLAR_LOG_LEVEL/SYLAR_LOG_FMT_LEVEL使用运行期级别, Appender级别过滤
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+/**
+ * @brief 记录收到的日志级别和内容
+ */
+class CaptureAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        m_levels.push_back(level);
+        m_eventLevels.push_back(event->getLevel());
+        m_contents.push_back(event->getContent());
+    }
+
+    std::vector<sylar::LogLevel::Level> m_levels;
+    std::vector<sylar::LogLevel::Level> m_eventLevels;
+    std::vector<std::string> m_contents;
+};
+
+/**
+ * @brief 只接受error及以上, 记录write()次数
+ */
+class ErrorAppender : public sylar::LogAppender {
+public:
+    ErrorAppender() {
+        m_level = sylar::LogLevel::ERROR;
+    }
+
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+    }
+
+    bool acceptsFormatted() const override { return true; }
+
+    void write(sylar::LogLevel::Level level, const sylar::LogEvent& event
+            , const char* data, size_t len) override {
+        ++ m_writes;
+    }
+
+    int m_writes = 0;
+};
+
+int main(int argc, char** argv) {
+    sylar::Logger::ptr logger(new sylar::Logger("level"));
+    auto capture = std::make_shared<CaptureAppender>();
+    logger->addAppender(capture);
+    logger->setLevel(sylar::LogLevel::WARN);
+
+    const sylar::LogLevel::Level levels[] = {sylar::LogLevel::DEBUG, sylar::LogLevel::ERROR
+        , sylar::LogLevel::INFO, sylar::LogLevel::WARN, sylar::LogLevel::FATAL};
+    // one call site, a different level on every call
+    for (auto lv : levels) {
+        SYLAR_LOG_LEVEL(logger, lv) << sylar::LogLevel::ToString(lv);
+    }
+    for (auto lv : levels) {
+        SYLAR_LOG_FMT_LEVEL(logger, lv, "fmt %s", sylar::LogLevel::ToString(lv));
+    }
+
+    const sylar::LogLevel::Level expect[] = {sylar::LogLevel::ERROR, sylar::LogLevel::WARN
+        , sylar::LogLevel::FATAL};
+    CHECK(capture->m_levels.size() == 6);
+    for (size_t i = 0; i < 6; ++i) {
+        sylar::LogLevel::Level lv = expect[i % 3];
+        std::string name = sylar::LogLevel::ToString(lv);
+        CHECK(capture->m_levels[i] == lv);
+        CHECK(capture->m_eventLevels[i] == lv);
+        CHECK(capture->m_contents[i] == (i < 3 ? name : "fmt " + name));
+    }
+
+    // the fixed-level macros still filter by the logger level
+    capture->m_levels.clear();
+    SYLAR_LOG_INFO(logger) << "dropped";
+    SYLAR_LOG_ERROR(logger) << "kept";
+    SYLAR_LOG_FMT_DEBUG(logger, "%s", "dropped");
+    SYLAR_LOG_FMT_WARN(logger, "%s", "kept");
+    CHECK(capture->m_levels.size() == 2);
+    CHECK(capture->m_levels[0] == sylar::LogLevel::ERROR);
+    CHECK(capture->m_levels[1] == sylar::LogLevel::WARN);
+
+    // the fan-out skips an appender below its own level before write()
+    sylar::Logger::ptr fanout(new sylar::Logger("fanout"));
+    auto error = std::make_shared<ErrorAppender>();
+    error->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m")));
+    fanout->addAppender(error);
+    SYLAR_LOG_INFO(fanout) << "skipped";
+    SYLAR_LOG_ERROR(fanout) << "written";
+    CHECK(error->m_writes == 1);
+    CHECK(error->getMetrics().filtered[sylar::LogLevel::INFO] == 1);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file test_log_mmap.cc
+ * @brief MmapFileWriter跨段和超过段大小的记录
+ */
+#include "sylar/log.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+static const int s_threads = 4;
+static const int s_lines = 2000;
+
+/**
+ * @brief 第i条记录: 由字符c组成的长度不定的一行, 部分超过一个或多个段
+ */
+static std::string Record(char c, int i, size_t segment) {
+    size_t len = i % 97 == 0 ? segment * (1 + i % 3) : 16 + i % 200;
+    // exact multiples of the segment size end a segment without a straddle
+    if (i % 101 == 0) {
+        len = segment * 2;
+    }
+    return std::string(len - 1, c) + "\n";
+}
+
+int main(int argc, char** argv) {
+    char path[] = "/tmp/sylar_test_log_mmap.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    size_t segment = sysconf(_SC_PAGESIZE);
+    {
+        sylar::MmapFileWriter writer(path, segment);
+        CHECK(writer.isOpen());
+        std::vector<std::thread> threads;
+        for (int t = 0; t < s_threads; ++ t) {
+            threads.emplace_back([&writer, t, segment]() {
+                for (int i = 0; i < s_lines; ++ i) {
+                    std::string r = Record('a' + t, i, segment);
+                    writer.write(r.data(), r.size());
+                }
+            });
+        }
+        for (auto& i : threads) {
+            i.join();
+        }
+    }
+
+    std::ifstream ifs(path);
+    std::vector<std::vector<size_t> > lens(s_threads);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        CHECK(!line.empty());
+        int t = line[0] - 'a';
+        CHECK(t >= 0 && t < s_threads);
+        CHECK(line.find_first_not_of(line[0]) == std::string::npos);
+        lens[t].push_back(line.size() + 1);
+    }
+    unlink(path);
+    for (int t = 0; t < s_threads; ++ t) {
+        CHECK(lens[t].size() == (size_t)s_lines);
+        for (int i = 0; i < s_lines; ++ i) {
+            CHECK(lens[t][i] == Record('a', i, segment).size());
+        }
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file test_log_rcu.cc
+ * @brief Logger的RCU快照: 删除appender的等待, 在appender中创建logger/修改appender
+ */
+#include "sylar/log.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    }
+
+/**
+ * @brief 每次输出时创建一个新logger并给另一个logger添加appender
+ */
+class ReentrantAppender : public sylar::LogAppender {
+public:
+    ReentrantAppender(sylar::Logger::ptr other)
+        :m_other(other) {
+    }
+
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        sylar::LoggerMgr::GetInstance()->getLogger("test.rcu." + std::to_string(m_count++));
+        m_other->addAppender(std::make_shared<sylar::StdoutLogAppender>());
+    }
+
+    int m_count = 0;
+private:
+    sylar::Logger::ptr m_other;
+};
+
+/**
+ * @brief 记录正在进行和已完成的调用, 每次调用停留一段时间
+ */
+class SlowAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        ++ m_inflight;
+        usleep(100);
+        ++ m_count;
+        -- m_inflight;
+    }
+
+    std::atomic<int> m_inflight{0};
+    std::atomic<int> m_count{0};
+};
+
+/**
+ * @brief 第一次被调用时把自己从日志器删除
+ */
+class SelfRemovingAppender : public sylar::LogAppender {
+public:
+    void log(std::shared_ptr<sylar::Logger> logger, sylar::LogLevel::Level level
+            , sylar::LogEvent::ptr event) override {
+        ++ m_count;
+        logger->delAppender(m_self.lock());
+    }
+
+    int m_count = 0;
+    std::weak_ptr<sylar::LogAppender> m_self;
+};
+
+static int TestDelAppenderWaits() {
+    sylar::Logger::ptr logger(new sylar::Logger("rcu.del"));
+    auto slow = std::make_shared<SlowAppender>();
+    logger->addAppender(slow);
+    std::atomic<bool> stop{false};
+    std::thread t([&]() {
+        while (!stop) {
+            SYLAR_LOG_INFO(logger) << "slow";
+        }
+    });
+    while (slow->m_count < 10) {
+        usleep(100);
+    }
+    logger->delAppender(slow);
+    // no log() may still be inside or enter the removed appender
+    int inflight = slow->m_inflight;
+    int count = slow->m_count;
+    usleep(10000);
+    stop = true;
+    t.join();
+    CHECK(inflight == 0);
+    CHECK(slow->m_count == count);
+    return 0;
+}
+
+static int TestDelAppenderInside() {
+    sylar::Logger::ptr logger(new sylar::Logger("rcu.self"));
+    auto appender = std::make_shared<SelfRemovingAppender>();
+    appender->m_self = appender;
+    logger->addAppender(appender);
+    SYLAR_LOG_INFO(logger) << "first";
+    SYLAR_LOG_INFO(logger) << "second";
+    CHECK(appender->m_count == 1);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (TestDelAppenderWaits() || TestDelAppenderInside()) {
+        return 1;
+    }
+    sylar::Logger::ptr other(new sylar::Logger("other"));
+    sylar::Logger::ptr logger(new sylar::Logger("rcu"));
+    auto appender = std::make_shared<ReentrantAppender>(other);
+    logger->addAppender(appender);
+    for (int i = 0; i < 3; ++ i) {
+        SYLAR_LOG_INFO(logger) << "reentrant " << i;
+    }
+    CHECK(appender->m_count == 3);
+    CHECK(sylar::LoggerMgr::GetInstance()->lookup("test.rcu.2") != nullptr);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * @brief sylar-logdecode: 把BinaryLogWriter写出的二进制日志还原成文本
+ * @details 用法: sylar-logdecode [-p pattern] file...
+ *          pattern为LogFormatter模板, 默认带毫秒时间的完整格式
+ */
+#include "sylar/log.h"
+#include <stdio.h>
+#include <string.h>
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-p pattern] file...\n", prog);
+}
+
+int main(int argc, char** argv) {
+    std::string pattern = "%d{%Y-%m-%d %H:%M:%S.%L}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+    int i = 1;
+    for (; i < argc; ++ i) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pattern = argv[++ i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            break;
+        }
+    }
+    if (i == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sylar::LogFormatter formatter(pattern);
+    if (formatter.isError()) {
+        return 1;
+    }
+    int rt = 0;
+    sylar::LogBuffer buf;
+    for (; i < argc; ++ i) {
+        sylar::BinaryLogReader reader(argv[i]);
+        if (!reader.isValid()) {
+            fprintf(stderr, "%s: not a sylar binary log\n", argv[i]);
+            rt = 1;
+            continue;
+        }
+        sylar::LogEvent::ptr event;
+        while (reader.next(event)) {
+            buf.clear();
+            formatter.format(buf, *event->getLogger(), event->getLevel(), *event);
+            fwrite(buf.data(), 1, buf.size(), stdout);
+        }
+    }
+    return rt;
+}